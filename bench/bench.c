@@ -0,0 +1,444 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Runs every engine on the same workloads, several times each, and reports
+ * wall time (min / median / p95), peak RSS and an FNV-1a checksum of the
+ * program output.  A checksum that differs from the first engine's on the
+ * same workload is flagged, since a fast wrong answer is not a speedup.
+ */
+
+struct Engine {
+	const char* name;
+	const char* binary;
+	const char* flag;
+	/* bfjustinput takes the program text itself, not a file name. */
+	bool source_as_arg;
+};
+
+struct Workload {
+	const char* name;
+	const char* file;
+	const char* input;
+};
+
+static const struct Engine engines[] = {
+	{.name = "bf", .binary = "bf"},
+	{.name = "bfsimple", .binary = "bfsimple"},
+	{.name = "bfjustinput", .binary = "bfjustinput", .source_as_arg = true},
+	{.name = "bfopt", .binary = "bfopt"},
+	{.name = "bflist", .binary = "bflist"},
+	{.name = "bfblackmagic", .binary = "bfblackmagic"},
+	{.name = "bfblackmagic -j", .binary = "bfblackmagic", .flag = "-j"},
+	{.name = "bftail", .binary = "bftail"},
+	{.name = "bfspmd", .binary = "bfspmd"},
+};
+
+static const struct Workload workloads[] = {
+	{.name = "helloworld", .file = "helloworld.bf", .input = ""},
+	{.name = "prime", .file = "prime.bf", .input = "100\n"},
+	{.name = "mandelbrot", .file = "mandelbrot.bf", .input = ""},
+};
+
+#define ENGINE_COUNT (sizeof(engines) / sizeof(engines[0]))
+#define WORKLOAD_COUNT (sizeof(workloads) / sizeof(workloads[0]))
+
+struct Result {
+	bool ok;
+	double min_ms;
+	double median_ms;
+	double p95_ms;
+	long peak_rss_kb;
+	uint64_t checksum;
+	size_t output_size;
+};
+
+struct Config {
+	const char* build_dir;
+	const char* tests_dir;
+	const char* json_path;
+	const char* only;
+	int runs;
+};
+
+static inline uint64_t fnv1a(uint64_t hash, const uint8_t* data, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		hash ^= data[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+char* read_file(const char* filename)
+{
+	FILE* f = fopen(filename, "rb");
+	if (!f)
+		return nullptr;
+	fseek(f, 0, SEEK_END);
+	long length = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char* buffer = malloc(length + 1);
+	if (buffer) {
+		fread(buffer, 1, length, f);
+		buffer[length] = '\0';
+	}
+	fclose(f);
+	return buffer;
+}
+
+bool write_all(int fd, const char* data, size_t size)
+{
+	size_t done = 0;
+	while (done < size) {
+		ssize_t n = write(fd, data + done, size - done);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		done += (size_t)n;
+	}
+	return true;
+}
+
+/*
+ * One run: the child gets `input` on stdin (small enough for the pipe
+ * buffer) and its stdout is hashed as it streams in.  Peak RSS comes from
+ * wait4 so it covers the child only.
+ */
+bool run_once(char* const argv[], const char* input, double* wall_ms,
+	      long* rss_kb, uint64_t* checksum, size_t* output_size)
+{
+	int in_pipe[2], out_pipe[2];
+	if (pipe(in_pipe) != 0)
+		return false;
+	if (pipe(out_pipe) != 0) {
+		close(in_pipe[0]);
+		close(in_pipe[1]);
+		return false;
+	}
+
+	double start = now_ms();
+	pid_t pid    = fork();
+	if (pid < 0)
+		return false;
+
+	if (pid == 0) {
+		dup2(in_pipe[0], STDIN_FILENO);
+		dup2(out_pipe[1], STDOUT_FILENO);
+		close(in_pipe[0]);
+		close(in_pipe[1]);
+		close(out_pipe[0]);
+		close(out_pipe[1]);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+
+	close(in_pipe[0]);
+	close(out_pipe[1]);
+	write_all(in_pipe[1], input, strlen(input));
+	close(in_pipe[1]);
+
+	uint64_t hash = 0xcbf29ce484222325ull;
+	size_t total  = 0;
+	uint8_t buffer[65536];
+	for (;;) {
+		ssize_t n = read(out_pipe[0], buffer, sizeof(buffer));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		hash = fnv1a(hash, buffer, (size_t)n);
+		total += (size_t)n;
+	}
+	close(out_pipe[0]);
+
+	int status;
+	struct rusage usage;
+	while (wait4(pid, &status, 0, &usage) < 0) {
+		if (errno != EINTR)
+			return false;
+	}
+	*wall_ms     = now_ms() - start;
+	*rss_kb	     = usage.ru_maxrss;
+	*checksum    = hash;
+	*output_size = total;
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int compare_double(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of an already sorted sample. */
+double percentile(const double* sorted, int n, double p)
+{
+	int rank = (int)(p / 100.0 * n + 0.999999);
+	if (rank < 1)
+		rank = 1;
+	if (rank > n)
+		rank = n;
+	return sorted[rank - 1];
+}
+
+struct Result bench_one(const struct Config* config,
+			const struct Engine* engine,
+			const struct Workload* workload)
+{
+	struct Result result = {0};
+
+	char binary[4096], source[4096];
+	snprintf(binary, sizeof(binary), "%s/%s", config->build_dir,
+		 engine->binary);
+	snprintf(source, sizeof(source), "%s/%s", config->tests_dir,
+		 workload->file);
+
+	char* text = nullptr;
+	char* argv[4];
+	int argc     = 0;
+	argv[argc++] = binary;
+	if (engine->flag)
+		argv[argc++] = (char*)engine->flag;
+	if (engine->source_as_arg) {
+		text = read_file(source);
+		if (!text)
+			return result;
+		argv[argc++] = text;
+	} else {
+		argv[argc++] = source;
+	}
+	argv[argc] = nullptr;
+
+	double* times = malloc(sizeof(double) * (size_t)config->runs);
+	if (!times) {
+		free(text);
+		return result;
+	}
+
+	result.ok = true;
+	for (int run = 0; run < config->runs; ++run) {
+		long rss;
+		uint64_t checksum;
+		size_t size;
+		if (!run_once(argv, workload->input, &times[run], &rss,
+			      &checksum, &size)) {
+			result.ok = false;
+			break;
+		}
+		if (run > 0 && checksum != result.checksum) {
+			result.ok = false;
+			break;
+		}
+		if (rss > result.peak_rss_kb)
+			result.peak_rss_kb = rss;
+		result.checksum	   = checksum;
+		result.output_size = size;
+	}
+
+	if (result.ok) {
+		qsort(times, (size_t)config->runs, sizeof(double),
+		      compare_double);
+		result.min_ms	 = times[0];
+		result.median_ms = percentile(times, config->runs, 50);
+		result.p95_ms	 = percentile(times, config->runs, 95);
+	}
+
+	free(times);
+	free(text);
+	return result;
+}
+
+void print_table(const struct Result results[ENGINE_COUNT][WORKLOAD_COUNT],
+		 const bool selected[ENGINE_COUNT])
+{
+	printf("%-16s %-11s %10s %10s %10s %9s %16s\n", "engine", "workload",
+	       "min ms", "median ms", "p95 ms", "rss KiB", "checksum");
+
+	for (size_t w = 0; w < WORKLOAD_COUNT; ++w) {
+		const struct Result* reference = nullptr;
+
+		for (size_t e = 0; e < ENGINE_COUNT; ++e) {
+			if (!selected[e])
+				continue;
+
+			const struct Result* r = &results[e][w];
+			if (!r->ok) {
+				printf("%-16s %-11s %10s\n", engines[e].name,
+				       workloads[w].name, "FAILED");
+				continue;
+			}
+			if (!reference)
+				reference = r;
+
+			bool differs = r->checksum != reference->checksum;
+			printf("%-16s %-11s %10.2f %10.2f %10.2f %9ld "
+			       "%016llx%s\n",
+			       engines[e].name, workloads[w].name, r->min_ms,
+			       r->median_ms, r->p95_ms, r->peak_rss_kb,
+			       (unsigned long long)r->checksum,
+			       differs ? " MISMATCH" : "");
+		}
+	}
+}
+
+bool write_json(const char* path,
+		const struct Result results[ENGINE_COUNT][WORKLOAD_COUNT],
+		const bool selected[ENGINE_COUNT], int runs)
+{
+	FILE* f = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+	if (!f)
+		return false;
+
+	fprintf(f, "{\n  \"runs\": %d,\n  \"results\": [", runs);
+	bool first = true;
+	for (size_t e = 0; e < ENGINE_COUNT; ++e) {
+		if (!selected[e])
+			continue;
+
+		for (size_t w = 0; w < WORKLOAD_COUNT; ++w) {
+			const struct Result* r = &results[e][w];
+
+			fprintf(f, "%s\n    {\"engine\": \"%s\", "
+				   "\"workload\": \"%s\", \"ok\": %s",
+				first ? "" : ",", engines[e].name,
+				workloads[w].name, r->ok ? "true" : "false");
+			if (r->ok)
+				fprintf(f,
+					", \"min_ms\": %.3f, \"median_ms\": "
+					"%.3f, \"p95_ms\": %.3f, "
+					"\"peak_rss_kb\": %ld, \"checksum\": "
+					"\"%016llx\", \"output_bytes\": %zu",
+					r->min_ms, r->median_ms, r->p95_ms,
+					r->peak_rss_kb,
+					(unsigned long long)r->checksum,
+					r->output_size);
+			fprintf(f, "}");
+			first = false;
+		}
+	}
+	fprintf(f, "\n  ]\n}\n");
+
+	if (f != stdout)
+		fclose(f);
+	return true;
+}
+
+void print_usage(const char* prog_name)
+{
+	printf("Usage: %s [options]\n", prog_name);
+	printf("  -h, --help           Show help\n");
+	printf("  -n, --runs <count>   Runs per engine and workload (5 "
+	       "default)\n");
+	printf("  -b, --build <dir>    Directory holding the engines (build "
+	       "default)\n");
+	printf("  -t, --tests <dir>    Directory holding the programs (tests "
+	       "default)\n");
+	printf("  -o, --json <file>    Also write the results as JSON ('-' "
+	       "for stdout)\n");
+	printf("  -e, --engine <name>  Only run engines whose name starts "
+	       "with <name>\n");
+}
+
+int main(int argc, char* argv[])
+{
+	struct Config config = {.build_dir = "build",
+				.tests_dir = "tests",
+				.json_path = nullptr,
+				.only	   = nullptr,
+				.runs	   = 5};
+
+	static const struct option long_options[] = {
+		{"help", no_argument, 0, 'h'},
+		{"runs", required_argument, 0, 'n'},
+		{"build", required_argument, 0, 'b'},
+		{"tests", required_argument, 0, 't'},
+		{"json", required_argument, 0, 'o'},
+		{"engine", required_argument, 0, 'e'},
+		{0}};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "hn:b:t:o:e:", long_options,
+				  nullptr)) != -1) {
+		switch (opt) {
+		case 'h':
+			print_usage(argv[0]);
+			return 0;
+		case 'n': {
+			char* endptr;
+			long runs = strtol(optarg, &endptr, 10);
+			if (*endptr != '\0' || runs <= 0 || runs > 100000)
+				return EXIT_FAILURE;
+			config.runs = (int)runs;
+			break;
+		}
+		case 'b':
+			config.build_dir = optarg;
+			break;
+		case 't':
+			config.tests_dir = optarg;
+			break;
+		case 'o':
+			config.json_path = optarg;
+			break;
+		case 'e':
+			config.only = optarg;
+			break;
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	static struct Result results[ENGINE_COUNT][WORKLOAD_COUNT];
+	bool selected[ENGINE_COUNT];
+
+	for (size_t e = 0; e < ENGINE_COUNT; ++e) {
+		selected[e] = !config.only ||
+			      strncmp(engines[e].name, config.only,
+				      strlen(config.only)) == 0;
+		if (!selected[e])
+			continue;
+
+		for (size_t w = 0; w < WORKLOAD_COUNT; ++w) {
+			fprintf(stderr, "%s / %s...\n", engines[e].name,
+				workloads[w].name);
+			results[e][w] =
+				bench_one(&config, &engines[e], &workloads[w]);
+		}
+	}
+
+	print_table(results, selected);
+
+	if (config.json_path &&
+	    !write_json(config.json_path, results, selected, config.runs)) {
+		perror("Failed to write JSON");
+		return EXIT_FAILURE;
+	}
+
+	bool all_ok = true;
+	for (size_t e = 0; e < ENGINE_COUNT; ++e)
+		for (size_t w = 0; w < WORKLOAD_COUNT; ++w)
+			all_ok = all_ok && (!selected[e] || results[e][w].ok);
+	return all_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,131 @@
+#ifndef BF_H
+#define BF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * libbf: the bflist compiler and interpreter as a library.
+ *
+ * bf_compile turns a source buffer into a BfProgram, which is never written
+ * to again: any number of contexts, on any number of threads, can run it at
+ * once.  A BfContext is one execution of a program, with its own tape,
+ * position and I/O state; it must only be used by one thread at a time.
+ * The library keeps no global state and never touches stdin, stdout or
+ * signal handlers, so every call is reentrant.
+ *
+ * A run can also stop short and be picked up later: bf_resume returns as
+ * soon as the program wants input it has not been given or has filled the
+ * output buffer, with everything needed to carry on kept in the context.
+ * One thread can so drive any number of interactive programs from an
+ * event loop, feeding each as its input arrives.
+ */
+
+enum BfStatus {
+	BfStatus_OK,
+	BfStatus_UNMATCHED_OPEN,
+	BfStatus_UNMATCHED_CLOSE,
+	BfStatus_NO_MEMORY,
+	BfStatus_TAPE_LEFT,
+	BfStatus_TAPE_RIGHT,
+	BfStatus_OUTPUT_FULL,
+	BfStatus_NEED_INPUT,
+	BfStatus_OUT_OF_FUEL,
+	BfStatus_IO_ERROR
+};
+
+/* What went wrong, worded like the command-line engines' errors. */
+const char* bf_status_message(enum BfStatus status);
+
+struct BfProgram;
+struct BfContext;
+
+/*
+ * Compiles `size` bytes of source.  `limit` is the tape length limit, as
+ * -m sets it for the engines; 0 picks their default of 30000 cells.
+ */
+enum BfStatus bf_compile(const char* source, size_t size, size_t limit,
+			 struct BfProgram** program);
+void bf_program_free(struct BfProgram* program);
+
+/* A fresh execution of `program`, which must outlive it; null on ENOMEM. */
+struct BfContext* bf_context_new(const struct BfProgram* program);
+
+/* Rewinds to the start of the program with a blank tape and open input. */
+void bf_context_reset(struct BfContext* ctx);
+void bf_context_free(struct BfContext* ctx);
+
+/*
+ * Fuel bounds how much work a context may do.  Every taken loop back-edge
+ * costs the length of the loop body in bytecode words, which is about the
+ * number of ops one trip runs.  A trip costing more than is left takes
+ * what remains; a context with no fuel at all stops with
+ * BfStatus_OUT_OF_FUEL, before the jump, and carries on from there once
+ * given more, so any nonzero amount makes progress.  Contexts start with
+ * BF_FUEL_UNLIMITED, which is never charged; bf_context_reset leaves the
+ * fuel as it is.
+ */
+#define BF_FUEL_UNLIMITED UINT64_MAX
+
+void bf_set_fuel(struct BfContext* ctx, uint64_t fuel);
+uint64_t bf_fuel(const struct BfContext* ctx);
+
+/*
+ * Program I/O through callbacks.  `read` stores up to `size` bytes of input
+ * and returns how many; 0 means end of input, on which INPUT leaves the
+ * cell as it is.  `write` takes output in chunks and returns false to stop
+ * the run with BfStatus_IO_ERROR.  Output is handed to `write` before every
+ * call to `read` and when the run stops.  Either callback may be null: no
+ * input, or output thrown away.
+ */
+struct BfIo {
+	size_t (*read)(void* user, uint8_t* data, size_t size);
+	bool (*write)(void* user, const uint8_t* data, size_t size);
+	void* user;
+};
+
+/*
+ * Runs the program from where the context stands until it halts
+ * (BfStatus_OK) or fails.
+ */
+enum BfStatus bf_run(struct BfContext* ctx, const struct BfIo* io);
+
+/*
+ * Runs over memory: input comes from `input`, output goes to `output`, and
+ * `*output_size` is set to how much of it was written.  Output beyond
+ * `output_cap` stops the run with BfStatus_OUTPUT_FULL.
+ */
+enum BfStatus bf_run_buffers(struct BfContext* ctx, const uint8_t* input,
+			     size_t input_size, uint8_t* output,
+			     size_t output_cap, size_t* output_size);
+
+/*
+ * Runs until the program halts, or suspends it: with BfStatus_NEED_INPUT
+ * when it reads past the end of `input`, with BfStatus_OUTPUT_FULL when
+ * `output` has no room left.  `*input_used` and `*output_size` say how much
+ * of either buffer the run got through; the rest of the input has not been
+ * seen.  Calling bf_resume again continues from the exact op it stopped
+ * on, with whatever input and output buffers come next.  Neither buffer is
+ * kept past the call.
+ */
+enum BfStatus bf_resume(struct BfContext* ctx, const uint8_t* input,
+			size_t input_size, size_t* input_used,
+			uint8_t* output, size_t output_cap,
+			size_t* output_size);
+
+/*
+ * No more input will come: from now on reading past what bf_resume is
+ * given yields end of input instead of BfStatus_NEED_INPUT.
+ */
+void bf_end_input(struct BfContext* ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1366 @@
+#define _GNU_SOURCE
+#include "frontend.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define SCAN_LANES 32
+
+static inline uint32_t scan_zero_mask(const uint8_t* p)
+{
+	__m256i v = _mm256_loadu_si256((const __m256i*)p);
+	return (uint32_t)_mm256_movemask_epi8(
+		_mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+}
+#elif defined(__SSE2__)
+#define SCAN_LANES 16
+
+static inline uint32_t scan_zero_mask(const uint8_t* p)
+{
+	__m128i v = _mm_loadu_si128((const __m128i*)p);
+	return (uint32_t)_mm_movemask_epi8(
+		_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+}
+#endif
+
+/*
+ * Distance to the first zero among p[0], p[stride], p[2 * stride], ... when
+ * only p[0] .. p[n - 1] may be read.  A scan that finds nothing stops at the
+ * first multiple of stride >= n, past the end of the tape, where the next
+ * touch of the head cell faults.
+ */
+size_t scan_right(const uint8_t* p, size_t n, size_t stride)
+{
+	if (stride == 1) {
+		const uint8_t* hit = memchr(p, 0, n);
+		return hit ? (size_t)(hit - p) : n;
+	}
+
+	size_t i = 0;
+#ifdef SCAN_LANES
+	if (stride < SCAN_LANES) {
+		size_t step	 = (SCAN_LANES / stride) * stride;
+		uint32_t pattern = 0;
+		for (size_t j = 0; j < step; j += stride)
+			pattern |= 1u << j;
+
+		for (; i + SCAN_LANES <= n; i += step) {
+			uint32_t mask = scan_zero_mask(p + i) & pattern;
+			if (mask)
+				return i + (size_t)__builtin_ctz(mask);
+		}
+	}
+#endif
+	for (; i < n; i += stride) {
+		if (p[i] == 0)
+			return i;
+	}
+	return i;
+}
+
+/* Same as scan_right, walking down from p[0] to p[-(n - 1)]. */
+size_t scan_left(const uint8_t* p, size_t n, size_t stride)
+{
+	if (stride == 1) {
+		const uint8_t* hit = memrchr(p - n + 1, 0, n);
+		return hit ? (size_t)(p - hit) : n;
+	}
+
+	size_t i = 0;
+#ifdef SCAN_LANES
+	if (stride < SCAN_LANES) {
+		size_t step	 = (SCAN_LANES / stride) * stride;
+		uint32_t pattern = 0;
+		for (size_t j = 0; j < step; j += stride)
+			pattern |= 1u << (SCAN_LANES - 1 - j);
+
+		for (; i + SCAN_LANES <= n; i += step) {
+			uint32_t mask =
+				scan_zero_mask(p - i - (SCAN_LANES - 1)) &
+				pattern;
+			if (mask)
+				return i + (size_t)__builtin_clz(mask) -
+				       (32 - SCAN_LANES);
+		}
+	}
+#endif
+	for (; i < n; i += stride) {
+		if (p[-(long)i] == 0)
+			return i;
+	}
+	return i;
+}
+
+bool program_init(struct Program* prog)
+{
+	prog->capacity = 1024;
+	prog->size     = 0;
+	prog->reach    = 0;
+	prog->travel   = 0;
+	prog->data     = nullptr;
+	prog->data_size = 0;
+	prog->source_cursor = 0;
+	prog->ops      = malloc(sizeof(struct Instruction) * prog->capacity);
+	prog->source_pos = malloc(sizeof(size_t) * prog->capacity);
+	return prog->ops != nullptr && prog->source_pos != nullptr;
+}
+
+void program_free(struct Program* prog)
+{
+	if (prog->ops)
+		free(prog->ops);
+	if (prog->data)
+		free(prog->data);
+	if (prog->source_pos)
+		free(prog->source_pos);
+	prog->ops      = nullptr;
+	prog->source_pos = nullptr;
+	prog->data     = nullptr;
+	prog->data_size = 0;
+	prog->size     = 0;
+	prog->capacity = 0;
+}
+
+static bool program_reserve(struct Program* prog, size_t capacity)
+{
+	if (capacity <= prog->capacity)
+		return true;
+
+	struct Instruction* new_ops =
+		realloc(prog->ops, sizeof(struct Instruction) * capacity);
+	if (!new_ops)
+		return false;
+	prog->ops = new_ops;
+
+	size_t* new_pos = realloc(prog->source_pos, sizeof(size_t) * capacity);
+	if (!new_pos)
+		return false;
+	prog->source_pos = new_pos;
+	prog->capacity	 = capacity;
+	return true;
+}
+
+static bool program_push(struct Program* prog, struct Instruction instr)
+{
+	if (prog->size >= prog->capacity) {
+		size_t new_cap		    = prog->capacity * 2;
+		struct Instruction* new_ops = realloc(
+			prog->ops, sizeof(struct Instruction) * new_cap);
+		if (!new_ops)
+			return false;
+		prog->ops = new_ops;
+
+		size_t* new_pos =
+			realloc(prog->source_pos, sizeof(size_t) * new_cap);
+		if (!new_pos)
+			return false;
+		prog->source_pos = new_pos;
+		prog->capacity	 = new_cap;
+	}
+	prog->source_pos[prog->size] = prog->source_cursor;
+	prog->ops[prog->size++]	     = instr;
+	return true;
+}
+
+static bool program_flush_move(struct Program* prog, long* pending)
+{
+	if (*pending == 0)
+		return true;
+
+	struct Instruction instr = {0};
+	if (*pending > 0) {
+		instr.type    = OperationType_INC_PTR;
+		instr.operand = (size_t)*pending;
+	} else {
+		instr.type    = OperationType_DEC_PTR;
+		instr.operand = (size_t)-*pending;
+	}
+	*pending = 0;
+	return program_push(prog, instr);
+}
+
+#define MUL_LOOP_MAX_TARGETS 16
+
+/*
+ * Rewrites a just-closed loop whose body only adds to cells and moves the
+ * pointer, ends where it started and changes its control cell by exactly one
+ * per iteration (e.g. "[->++>+++<<]" or "[-<+>]").  Such a loop runs `value`
+ * times, so each touched cell simply receives value * delta: emit one MUL_ADD
+ * per target followed by a SET_VAL of zero on the control cell.
+ */
+static bool compile_mul_loop(struct Program* prog, size_t open_idx)
+{
+	struct {
+		long offset;
+		uint8_t delta;
+	} cells[MUL_LOOP_MAX_TARGETS + 1] = {{0, 0}};
+	size_t cell_count = 1;
+	long pos	  = 0;
+
+	for (size_t k = open_idx + 1; k < prog->size; ++k) {
+		struct Instruction* op = &prog->ops[k];
+		uint8_t delta;
+
+		switch (op->type) {
+		case OperationType_INC_PTR:
+			pos += (long)op->operand;
+			continue;
+		case OperationType_DEC_PTR:
+			pos -= (long)op->operand;
+			continue;
+		case OperationType_ADD_VAL:
+			delta = (uint8_t)op->operand;
+			break;
+		case OperationType_SUB_VAL:
+			delta = (uint8_t)-(uint8_t)op->operand;
+			break;
+		default:
+			return false;
+		}
+
+		long target = pos + op->offset;
+		if (target > MAX_OFFSET || target < -MAX_OFFSET)
+			return false;
+
+		size_t c = 0;
+		while (c < cell_count && cells[c].offset != target)
+			c++;
+		if (c == cell_count) {
+			if (cell_count > MUL_LOOP_MAX_TARGETS)
+				return false;
+			cells[c].offset = target;
+			cells[c].delta	= 0;
+			cell_count++;
+		}
+		cells[c].delta += delta;
+	}
+
+	/* cells[0] is the control cell: it must step towards zero by one. */
+	if (pos != 0 || (cells[0].delta != 1 && cells[0].delta != UINT8_MAX))
+		return false;
+
+	/*
+	 * Counting up to zero runs 256 - value times: negate the factors.
+	 * Every target came from at least one body op, so the rewrite always
+	 * fits in the slots the loop occupied.
+	 */
+	bool negate    = cells[0].delta == 1;
+	size_t loop_at = prog->source_pos[open_idx];
+	prog->size     = open_idx;
+
+	for (size_t c = 1; c < cell_count; ++c) {
+		uint8_t factor = negate ? (uint8_t)-cells[c].delta
+					: cells[c].delta;
+		if (factor == 0)
+			continue;
+
+		prog->source_pos[prog->size] = loop_at;
+		prog->ops[prog->size++] =
+			(struct Instruction){.type    = OperationType_MUL_ADD,
+					     .operand = factor,
+					     .offset  = cells[c].offset};
+	}
+
+	prog->source_pos[prog->size] = loop_at;
+	prog->ops[prog->size++] =
+		(struct Instruction){.type = OperationType_SET_VAL};
+	return true;
+}
+
+/* "[>>>]" and "[<]" only search for a zero cell: emit one SCAN op. */
+static bool compile_scan_loop(struct Program* prog, size_t open_idx)
+{
+	if (prog->size != open_idx + 2)
+		return false;
+
+	struct Instruction* move = &prog->ops[open_idx + 1];
+	if (move->type == OperationType_INC_PTR)
+		prog->ops[open_idx].type = OperationType_SCAN_RIGHT;
+	else if (move->type == OperationType_DEC_PTR)
+		prog->ops[open_idx].type = OperationType_SCAN_LEFT;
+	else
+		return false;
+
+	prog->ops[open_idx].operand = move->operand;
+	prog->size		    = open_idx + 1;
+	return true;
+}
+
+/*
+ * reach is the largest offset any op addresses; travel bounds how far the
+ * head can get without touching a cell (every move and scan stride added
+ * up), which is what the tape's guard has to cover.
+ */
+static void program_update_reach(struct Program* prog)
+{
+	prog->reach  = 0;
+	prog->travel = 0;
+	for (size_t k = 0; k < prog->size; ++k) {
+		switch (prog->ops[k].type) {
+		case OperationType_INC_PTR:
+		case OperationType_DEC_PTR:
+		case OperationType_SCAN_RIGHT:
+		case OperationType_SCAN_LEFT:
+			prog->travel += prog->ops[k].operand;
+			break;
+		default:
+			break;
+		}
+
+		if (prog->ops[k].type == OperationType_WRITE_LITERAL)
+			continue;
+
+		long offset  = prog->ops[k].offset;
+		size_t reach = (size_t)(offset < 0 ? -offset : offset);
+		if (reach > prog->reach)
+			prog->reach = reach;
+	}
+}
+
+/* A growable stack of op indexes, so loops nest as deep as memory allows. */
+struct IndexStack {
+	size_t* items;
+	size_t size;
+	size_t capacity;
+};
+
+static bool index_stack_push(struct IndexStack* self, size_t index)
+{
+	if (self->size == self->capacity) {
+		size_t new_cap	  = self->capacity ? self->capacity * 2 : 64;
+		size_t* new_items = realloc(self->items, sizeof(size_t) * new_cap);
+		if (!new_items)
+			return false;
+		self->items    = new_items;
+		self->capacity = new_cap;
+	}
+	self->items[self->size++] = index;
+	return true;
+}
+
+static void index_stack_free(struct IndexStack* self)
+{
+	free(self->items);
+	self->items    = nullptr;
+	self->size     = 0;
+	self->capacity = 0;
+}
+
+/*
+ * Compiles source[begin, end) onto prog; `len` bounds the "[-]" lookahead.
+ * Loops still open at `end` are left on `open`, and a ']' with nothing to
+ * close becomes a JUMP_NONZERO whose index goes on `orphans`, both for the
+ * caller to resolve.  `flush_tail` emits the move pending at `end`, as the
+ * '[' there would have in a single pass.
+ */
+static bool compile_chunk(const char* source, size_t len, size_t begin,
+			  size_t end, bool flush_tail, struct Program* prog,
+			  struct IndexStack* open, struct IndexStack* orphans)
+{
+	long pending = 0;
+
+	for (size_t i = begin; i < end; ++i) {
+		char c			 = source[i];
+		struct Instruction instr = {0};
+		bool emit_instruction	 = true;
+		prog->source_cursor	 = i;
+
+		switch (c) {
+		case '>':
+			pending++;
+			emit_instruction = false;
+			break;
+		case '<':
+			pending--;
+			emit_instruction = false;
+			break;
+		case '+':
+			instr.type    = OperationType_ADD_VAL;
+			instr.operand = 1;
+			while (i + 1 < len && source[i + 1] == '+') {
+				instr.operand++;
+				i++;
+			}
+			break;
+		case '-':
+			instr.type    = OperationType_SUB_VAL;
+			instr.operand = 1;
+			while (i + 1 < len && source[i + 1] == '-') {
+				instr.operand++;
+				i++;
+			}
+			break;
+		case '.':
+			instr.type = OperationType_OUTPUT;
+			break;
+		case ',':
+			instr.type = OperationType_INPUT;
+			break;
+		case '[':
+
+			if (i + 2 < len &&
+			    (source[i + 1] == '-' || source[i + 1] == '+') &&
+			    source[i + 2] == ']') {
+				instr.type = OperationType_SET_VAL;
+				i += 2;
+			} else {
+				if (!program_flush_move(prog, &pending))
+					return false;
+				instr.type = OperationType_JUMP_ZERO;
+				if (!index_stack_push(open, prog->size))
+					return false;
+			}
+			break;
+		case ']':
+			if (!program_flush_move(prog, &pending))
+				return false;
+			if (open->size == 0) {
+				instr.type = OperationType_JUMP_NONZERO;
+				if (!index_stack_push(orphans, prog->size))
+					return false;
+				break;
+			}
+			size_t open_idx = open->items[--open->size];
+			if (compile_mul_loop(prog, open_idx) ||
+			    compile_scan_loop(prog, open_idx)) {
+				emit_instruction = false;
+				break;
+			}
+			instr.type    = OperationType_JUMP_NONZERO;
+			instr.operand = open_idx;
+			prog->ops[open_idx].operand = prog->size;
+			break;
+		default:
+			emit_instruction = false;
+			break;
+		}
+
+		if (!emit_instruction)
+			continue;
+
+		if (instr.type != OperationType_JUMP_ZERO &&
+		    instr.type != OperationType_JUMP_NONZERO) {
+			if (pending > MAX_OFFSET || pending < -MAX_OFFSET) {
+				if (!program_flush_move(prog, &pending))
+					return false;
+			}
+			instr.offset = pending;
+		}
+
+		if (!program_push(prog, instr))
+			return false;
+	}
+
+	if (flush_tail) {
+		prog->source_cursor = end;
+		return program_flush_move(prog, &pending);
+	}
+	return true;
+}
+
+/*
+ * Parallel front end.  The source is cut into one chunk per thread, each
+ * starting at a '[' that opens a real loop: a single pass flushes the
+ * pending move there, so every chunk starts from the same state as it
+ * would have mid-pass and compiles on its own.  A loop that spans chunks
+ * contains the loop its chunk starts with, so it could never have become a
+ * MUL_ADD or SCAN anyway and only its two jumps need linking.  The chunks
+ * are then copied into place in parallel, and the brackets left open
+ * across chunks are matched in order, like one pass would.
+ */
+#ifndef FRONTEND_CHUNK_MIN
+#define FRONTEND_CHUNK_MIN (8u << 20)
+#endif
+#define FRONTEND_MAX_THREADS 64
+
+struct FrontendChunk {
+	const char* source;
+	size_t len;
+	size_t begin;
+	size_t end;
+	struct Program prog;
+	struct IndexStack open;
+	struct IndexStack orphans;
+	bool ok;
+
+	/* Where the chunk's ops land in the whole program. */
+	struct Program* dest;
+	size_t base;
+};
+
+static size_t frontend_threads(size_t len)
+{
+	size_t threads = len / FRONTEND_CHUNK_MIN;
+	long cpus      = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus > 0 && threads > (size_t)cpus)
+		threads = (size_t)cpus;
+	if (threads > FRONTEND_MAX_THREADS)
+		threads = FRONTEND_MAX_THREADS;
+	return threads ? threads : 1;
+}
+
+static bool frontend_can_split(const char* source, size_t len, size_t i)
+{
+	return source[i] == '[' &&
+	       !(i + 2 < len && (source[i + 1] == '-' || source[i + 1] == '+') &&
+		 source[i + 2] == ']');
+}
+
+static void* frontend_compile_chunk(void* arg)
+{
+	struct FrontendChunk* chunk = arg;
+	chunk->ok = program_init(&chunk->prog) &&
+		    compile_chunk(chunk->source, chunk->len, chunk->begin,
+				  chunk->end, chunk->end < chunk->len,
+				  &chunk->prog, &chunk->open, &chunk->orphans);
+	return nullptr;
+}
+
+/* Jumps matched inside the chunk are rebased; the rest are set later. */
+static void* frontend_place_chunk(void* arg)
+{
+	struct FrontendChunk* chunk = arg;
+	struct Instruction* ops	    = chunk->dest->ops + chunk->base;
+
+	memcpy(ops, chunk->prog.ops,
+	       sizeof(struct Instruction) * chunk->prog.size);
+	memcpy(chunk->dest->source_pos + chunk->base, chunk->prog.source_pos,
+	       sizeof(size_t) * chunk->prog.size);
+	for (size_t k = 0; k < chunk->prog.size; ++k) {
+		if (ops[k].type == OperationType_JUMP_ZERO ||
+		    ops[k].type == OperationType_JUMP_NONZERO)
+			ops[k].operand += chunk->base;
+	}
+	return nullptr;
+}
+
+/* Runs `fn` on every chunk, the first on this thread. */
+static void frontend_run(struct FrontendChunk* chunks, size_t count,
+			 void* (*fn)(void*))
+{
+	pthread_t threads[FRONTEND_MAX_THREADS];
+	bool started[FRONTEND_MAX_THREADS] = {false};
+
+	for (size_t k = 1; k < count; ++k)
+		started[k] = pthread_create(&threads[k], nullptr, fn,
+					    &chunks[k]) == 0;
+	fn(&chunks[0]);
+	for (size_t k = 1; k < count; ++k) {
+		if (started[k])
+			pthread_join(threads[k], nullptr);
+		else
+			fn(&chunks[k]);
+	}
+}
+
+static bool compile_parallel(const char* source, size_t len, size_t threads,
+			     struct Program* prog, struct IndexStack* open,
+			     struct IndexStack* orphans)
+{
+	struct FrontendChunk* chunks =
+		calloc(threads, sizeof(struct FrontendChunk));
+	if (!chunks)
+		return false;
+
+	size_t count = 0;
+	for (size_t begin = 0; begin < len; ++count) {
+		size_t end = count + 1 == threads ? len
+						  : len / threads * (count + 1);
+		if (end <= begin)
+			end = begin + 1;
+		while (end < len && !frontend_can_split(source, len, end))
+			end++;
+
+		chunks[count] = (struct FrontendChunk){
+			.source = source, .len = len, .begin = begin, .end = end};
+		begin = end;
+	}
+
+	frontend_run(chunks, count, frontend_compile_chunk);
+
+	bool ok	     = true;
+	size_t total = 0;
+	for (size_t k = 0; k < count; ++k) {
+		ok &= chunks[k].ok;
+		chunks[k].dest = prog;
+		chunks[k].base = total;
+		total += chunks[k].prog.size;
+	}
+
+	/* One more slot for the HALT compile_source appends. */
+	if (ok && (ok = program_reserve(prog, total + 1))) {
+		frontend_run(chunks, count, frontend_place_chunk);
+		prog->size = total;
+	}
+
+	for (size_t k = 0; k < count; ++k) {
+		struct FrontendChunk* chunk = &chunks[k];
+		for (size_t o = 0; ok && o < chunk->orphans.size; ++o) {
+			size_t close = chunk->base + chunk->orphans.items[o];
+			if (open->size == 0) {
+				ok = index_stack_push(orphans, close);
+				continue;
+			}
+			size_t at		  = open->items[--open->size];
+			prog->ops[at].operand	  = close;
+			prog->ops[close].operand = at;
+		}
+		for (size_t o = 0; ok && o < chunk->open.size; ++o)
+			ok = index_stack_push(open,
+					      chunk->base + chunk->open.items[o]);
+
+		program_free(&chunk->prog);
+		index_stack_free(&chunk->open);
+		index_stack_free(&chunk->orphans);
+	}
+
+	free(chunks);
+	return ok;
+}
+
+/*
+ * Sources of at least two FRONTEND_CHUNK_MIN go through compile_parallel,
+ * which builds the same Program as the single pass.
+ */
+enum BfStatus compile_source(const char* source, size_t len,
+			     struct Program* prog)
+{
+	struct IndexStack open	  = {0};
+	struct IndexStack orphans = {0};
+
+	size_t threads = frontend_threads(len);
+	bool ok = threads > 1 ? compile_parallel(source, len, threads, prog,
+						 &open, &orphans)
+			      : compile_chunk(source, len, 0, len, false, prog,
+					      &open, &orphans);
+
+	enum BfStatus status = !ok		  ? BfStatus_NO_MEMORY
+			       : open.size > 0	  ? BfStatus_UNMATCHED_OPEN
+			       : orphans.size > 0 ? BfStatus_UNMATCHED_CLOSE
+						  : BfStatus_OK;
+	index_stack_free(&open);
+	index_stack_free(&orphans);
+	if (status != BfStatus_OK)
+		return status;
+
+	struct Instruction halt = {.type = OperationType_HALT};
+	if (!program_push(prog, halt))
+		return BfStatus_NO_MEMORY;
+
+	program_update_reach(prog);
+	return BfStatus_OK;
+}
+
+#define FOLD_WINDOW 4096
+#define FOLD_MAX_STEPS (1 << 20)
+
+/* Compile-time machine used to run the input-independent prefix. */
+struct FoldState {
+	uint8_t cells[2 * FOLD_WINDOW];
+	long pos;
+	long bound;
+	long lo_touched;
+	long hi_touched;
+
+	uint8_t* output;
+	size_t output_size;
+	size_t output_cap;
+
+	size_t steps;
+};
+
+static inline uint8_t* fold_cell(struct FoldState* st, long offset)
+{
+	long at = st->pos + offset;
+	if (at < -st->bound || at >= st->bound)
+		return nullptr;
+	if (at < st->lo_touched)
+		st->lo_touched = at;
+	if (at > st->hi_touched)
+		st->hi_touched = at;
+	return &st->cells[FOLD_WINDOW + at];
+}
+
+static bool fold_output(struct FoldState* st, uint8_t c)
+{
+	if (st->output_size == st->output_cap) {
+		size_t new_cap	 = st->output_cap ? st->output_cap * 2 : 256;
+		uint8_t* new_out = realloc(st->output, new_cap);
+		if (!new_out)
+			return false;
+		st->output     = new_out;
+		st->output_cap = new_cap;
+	}
+	st->output[st->output_size++] = c;
+	return true;
+}
+
+/*
+ * Runs ops [pc, end) on the compile-time tape.  Gives up (returns false) on
+ * input, on leaving the window or the tape limit, or when the step budget
+ * runs out; the caller then rolls the tape back.
+ */
+static bool fold_run(struct FoldState* st, struct Program* prog, size_t pc,
+		     size_t end)
+{
+	while (pc < end) {
+		struct Instruction instr = prog->ops[pc];
+		uint8_t* cell;
+
+		if (++st->steps > FOLD_MAX_STEPS)
+			return false;
+
+		switch (instr.type) {
+		case OperationType_INC_PTR:
+			st->pos += (long)instr.operand;
+			if (!fold_cell(st, 0))
+				return false;
+			break;
+		case OperationType_DEC_PTR:
+			st->pos -= (long)instr.operand;
+			if (!fold_cell(st, 0))
+				return false;
+			break;
+		case OperationType_ADD_VAL:
+			if (!(cell = fold_cell(st, instr.offset)))
+				return false;
+			*cell += (uint8_t)instr.operand;
+			break;
+		case OperationType_SUB_VAL:
+			if (!(cell = fold_cell(st, instr.offset)))
+				return false;
+			*cell -= (uint8_t)instr.operand;
+			break;
+		case OperationType_SET_VAL:
+			if (!(cell = fold_cell(st, instr.offset)))
+				return false;
+			*cell = (uint8_t)instr.operand;
+			break;
+		case OperationType_MUL_ADD: {
+			uint8_t value = *fold_cell(st, 0);
+			if (!(cell = fold_cell(st, instr.offset)))
+				return false;
+			*cell += value * (uint8_t)instr.operand;
+			break;
+		}
+		case OperationType_OUTPUT:
+			if (!(cell = fold_cell(st, instr.offset)) ||
+			    !fold_output(st, *cell))
+				return false;
+			break;
+		case OperationType_JUMP_ZERO:
+			if (*fold_cell(st, 0) == 0) {
+				pc = instr.operand + 1;
+				continue;
+			}
+			break;
+		case OperationType_JUMP_NONZERO:
+			if (*fold_cell(st, 0) != 0) {
+				pc = instr.operand + 1;
+				continue;
+			}
+			break;
+		case OperationType_SCAN_RIGHT:
+		case OperationType_SCAN_LEFT: {
+			long step = instr.type == OperationType_SCAN_RIGHT
+					    ? (long)instr.operand
+					    : -(long)instr.operand;
+			while (*fold_cell(st, 0) != 0) {
+				st->pos += step;
+				if (!fold_cell(st, 0) ||
+				    ++st->steps > FOLD_MAX_STEPS)
+					return false;
+			}
+			break;
+		}
+		case OperationType_INPUT:
+		case OperationType_WRITE_LITERAL:
+		case OperationType_HALT:
+			return false;
+		}
+		pc++;
+	}
+	return true;
+}
+
+/*
+ * Partial evaluation of the program's input-independent prefix.  Top-level
+ * ops and whole top-level loops are executed at compile time for as long as
+ * they never read input; the prefix is then replaced by one WRITE_LITERAL of
+ * everything it printed, SET_VALs recreating the tape it left behind and a
+ * move to its final head position.  A program that never reads input and
+ * fits the budget collapses to a single write.
+ */
+bool fold_constant_prefix(struct Program* prog, size_t limit)
+{
+	struct FoldState* st = calloc(1, sizeof(struct FoldState));
+	uint8_t* snapshot    = malloc(2 * FOLD_WINDOW);
+	if (!st || !snapshot) {
+		free(st);
+		free(snapshot);
+		return false;
+	}
+
+	st->bound = limit < FOLD_WINDOW ? (long)limit : FOLD_WINDOW;
+
+	size_t pc = 0;
+	while (prog->ops[pc].type != OperationType_HALT &&
+	       prog->ops[pc].type != OperationType_INPUT) {
+		size_t end = pc + 1;
+		if (prog->ops[pc].type == OperationType_JUMP_ZERO)
+			end = prog->ops[pc].operand + 1;
+
+		long saved_pos	      = st->pos;
+		long saved_lo	      = st->lo_touched;
+		long saved_hi	      = st->hi_touched;
+		size_t saved_output   = st->output_size;
+		size_t touched	      = (size_t)(saved_hi - saved_lo + 1);
+		const uint8_t* window = &st->cells[FOLD_WINDOW + saved_lo];
+
+		memcpy(snapshot, window, touched);
+		st->steps += touched / 64;
+
+		if (!fold_run(st, prog, pc, end)) {
+			memset(&st->cells[FOLD_WINDOW + st->lo_touched], 0,
+			       (size_t)(st->hi_touched - st->lo_touched + 1));
+			memcpy(&st->cells[FOLD_WINDOW + saved_lo], snapshot,
+			       touched);
+			st->pos		= saved_pos;
+			st->lo_touched	= saved_lo;
+			st->hi_touched	= saved_hi;
+			st->output_size = saved_output;
+			break;
+		}
+		pc = end;
+	}
+
+	free(snapshot);
+
+	if (pc == 0) {
+		free(st->output);
+		free(st);
+		return true;
+	}
+
+	struct Program folded;
+	bool ok = program_init(&folded);
+
+	if (ok && st->output_size) {
+		folded.data	 = st->output;
+		folded.data_size = st->output_size;
+		st->output	 = nullptr;
+		ok = program_push(&folded,
+				  (struct Instruction){
+					  .type	   = OperationType_WRITE_LITERAL,
+					  .operand = folded.data_size,
+					  .offset  = 0});
+	}
+
+	long head = 0;
+	for (long at = st->lo_touched; ok && at <= st->hi_touched; ++at) {
+		uint8_t value = st->cells[FOLD_WINDOW + at];
+		if (value == 0)
+			continue;
+
+		if (at - head > MAX_OFFSET || head - at > MAX_OFFSET) {
+			long pending = at - head;
+			ok	     = program_flush_move(&folded, &pending);
+			head	     = at;
+		}
+		ok = ok && program_push(&folded,
+					(struct Instruction){
+						.type	 = OperationType_SET_VAL,
+						.operand = value,
+						.offset	 = at - head});
+	}
+
+	long pending = st->pos - head;
+	ok	     = ok && program_flush_move(&folded, &pending);
+
+	size_t shift = folded.size;
+	for (size_t k = pc; ok && k < prog->size; ++k) {
+		struct Instruction instr = prog->ops[k];
+		if (instr.type == OperationType_JUMP_ZERO ||
+		    instr.type == OperationType_JUMP_NONZERO)
+			instr.operand = instr.operand - pc + shift;
+		folded.source_cursor = prog->source_pos[k];
+		ok = program_push(&folded, instr);
+	}
+
+	free(st->output);
+	free(st);
+
+	if (!ok) {
+		program_free(&folded);
+		return false;
+	}
+
+	program_free(prog);
+	*prog = folded;
+	program_update_reach(prog);
+	return true;
+}
+
+static size_t bytecode_op_size(const struct Instruction* instr,
+			       bool narrow_jumps)
+{
+	switch (instr->type) {
+	case OperationType_INC_PTR:
+	case OperationType_DEC_PTR:
+	case OperationType_SCAN_RIGHT:
+	case OperationType_SCAN_LEFT:
+		return instr->operand <= BYTECODE_NARROW_MAX ? 1 : 3;
+	case OperationType_JUMP_ZERO:
+	case OperationType_JUMP_NONZERO:
+		return narrow_jumps ? 1 : 3;
+	case OperationType_WRITE_LITERAL:
+		return 5;
+	default:
+		return 1;
+	}
+}
+
+static inline void bytecode_put(uint32_t* words, enum OpCode narrow,
+				enum OpCode wide, size_t operand, size_t size)
+{
+	if (size == 1) {
+		words[0] = (uint32_t)narrow | (uint32_t)operand << 8;
+	} else {
+		uint64_t value = operand;
+		words[0]       = (uint32_t)wide;
+		memcpy(words + 1, &value, sizeof(value));
+	}
+}
+
+bool bytecode_compile(struct Program* prog, struct Bytecode* code)
+{
+	/* Every op takes at most 5 words, so this bounds every jump target. */
+	bool narrow_jumps = prog->size <= BYTECODE_NARROW_MAX / 5;
+
+	code->data     = prog->data;
+	code->map      = nullptr;
+	code->map_size = 0;
+	code->word_at  = malloc(sizeof(size_t) * (prog->size + 1));
+	if (!code->word_at)
+		return false;
+
+	size_t words = 0;
+	for (size_t k = 0; k < prog->size; ++k) {
+		code->word_at[k] = words;
+		words += bytecode_op_size(&prog->ops[k], narrow_jumps);
+	}
+	code->word_at[prog->size] = words;
+
+	code->size  = words;
+	code->words = malloc(sizeof(uint32_t) * words);
+	if (!code->words) {
+		free(code->word_at);
+		code->word_at = nullptr;
+		return false;
+	}
+
+	for (size_t k = 0; k < prog->size; ++k) {
+		struct Instruction instr = prog->ops[k];
+		uint32_t* w		 = code->words + code->word_at[k];
+		size_t size		 = code->word_at[k + 1] - code->word_at[k];
+
+		switch (instr.type) {
+		case OperationType_INC_PTR:
+			bytecode_put(w, OpCode_INC_PTR, OpCode_INC_PTR_WIDE,
+				     instr.operand, size);
+			break;
+		case OperationType_DEC_PTR:
+			bytecode_put(w, OpCode_DEC_PTR, OpCode_DEC_PTR_WIDE,
+				     instr.operand, size);
+			break;
+		case OperationType_SCAN_RIGHT:
+			bytecode_put(w, OpCode_SCAN_RIGHT, OpCode_SCAN_RIGHT_WIDE,
+				     instr.operand, size);
+			break;
+		case OperationType_SCAN_LEFT:
+			bytecode_put(w, OpCode_SCAN_LEFT, OpCode_SCAN_LEFT_WIDE,
+				     instr.operand, size);
+			break;
+		case OperationType_JUMP_ZERO:
+			bytecode_put(w, OpCode_JUMP_ZERO, OpCode_JUMP_ZERO_WIDE,
+				     code->word_at[instr.operand + 1], size);
+			break;
+		case OperationType_JUMP_NONZERO:
+			bytecode_put(w, OpCode_JUMP_NONZERO,
+				     OpCode_JUMP_NONZERO_WIDE,
+				     code->word_at[instr.operand + 1], size);
+			break;
+		case OperationType_WRITE_LITERAL: {
+			uint64_t length = instr.operand;
+			uint64_t start	= (uint64_t)instr.offset;
+			w[0]		= OpCode_WRITE_LITERAL;
+			memcpy(w + 1, &length, sizeof(length));
+			memcpy(w + 3, &start, sizeof(start));
+			break;
+		}
+		case OperationType_HALT:
+			w[0] = OpCode_HALT;
+			break;
+		default:
+			if (instr.offset < INT16_MIN || instr.offset > INT16_MAX) {
+				free(code->words);
+				free(code->word_at);
+				code->words   = nullptr;
+				code->word_at = nullptr;
+				return false;
+			}
+			w[0] = (uint32_t)instr.type |
+			       (uint32_t)(uint8_t)instr.operand << 8 |
+			       (uint32_t)(uint16_t)(int16_t)instr.offset << 16;
+			break;
+		}
+	}
+	return true;
+}
+
+void bytecode_free(struct Bytecode* code)
+{
+	if (code->map)
+		munmap(code->map, code->map_size);
+	else
+		free(code->words);
+	free(code->word_at);
+	code->words   = nullptr;
+	code->word_at = nullptr;
+	code->size    = 0;
+}
+
+enum OpCode superinstruction_of(enum OperationType first,
+				enum OperationType second)
+{
+#define SUPER_MATCH(a, b)                                     \
+	if (first == OperationType_##a && second == OperationType_##b) \
+		return OpCode_##a##_##b;
+	SUPERINSTRUCTIONS(SUPER_MATCH)
+#undef SUPER_MATCH
+	return OpCode_COUNT;
+}
+
+enum OpCode superinstruction_split(enum OpCode op, enum OpCode* second)
+{
+	switch (op) {
+#define SUPER_SPLIT(a, b)             \
+	case OpCode_##a##_##b:        \
+		*second = OpCode_##b; \
+		return OpCode_##a;
+		SUPERINSTRUCTIONS(SUPER_SPLIT)
+#undef SUPER_SPLIT
+	default:
+		*second = OpCode_COUNT;
+		return op;
+	}
+}
+
+/*
+ * Only the opcode byte of the first word changes: the second op keeps its
+ * word, which the fused handler decodes before moving on, so word_at and
+ * every jump target stay valid.  A pair whose second op is a jump target
+ * is left alone, since control can land between the two.
+ */
+size_t bytecode_fuse(const struct Program* prog, struct Bytecode* code)
+{
+	bool* target = calloc(prog->size + 1, sizeof(bool));
+	if (!target)
+		return 0;
+
+	for (size_t k = 0; k < prog->size; ++k) {
+		enum OperationType type = prog->ops[k].type;
+		if (type == OperationType_JUMP_ZERO ||
+		    type == OperationType_JUMP_NONZERO)
+			target[prog->ops[k].operand + 1] = true;
+	}
+
+	size_t fused = 0;
+	for (size_t k = 0; k + 1 < prog->size; ++k) {
+		size_t at = code->word_at[k];
+		if (target[k + 1] || code->word_at[k + 1] != at + 1 ||
+		    code->word_at[k + 2] != at + 2)
+			continue;
+
+		enum OpCode op = superinstruction_of(prog->ops[k].type,
+						     prog->ops[k + 1].type);
+		if (op == OpCode_COUNT)
+			continue;
+
+		code->words[at] = (code->words[at] & ~0xFFu) | (uint32_t)op;
+		fused++;
+		k++;
+	}
+
+	free(target);
+	return fused;
+}
+
+bool write_all(int fd, const uint8_t* data, size_t size)
+{
+	size_t done = 0;
+	while (done < size) {
+		ssize_t n = write(fd, data + done, size - done);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		done += (size_t)n;
+	}
+	return true;
+}
+
+#define CACHE_MAGIC "BFCACHE"
+#define CACHE_VERSION 2
+
+/*
+ * FNV-1a over everything the bytecode depends on: the source, the tape
+ * limit the constant prefix was folded under, and the engine's format.
+ */
+uint64_t cache_key(const char* format, const char* source, size_t size,
+		   size_t limit)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	uint64_t version = CACHE_VERSION;
+	uint64_t max = limit;
+
+	const uint8_t* parts[] = {(const uint8_t*)format,
+				  (const uint8_t*)&version,
+				  (const uint8_t*)&max, (const uint8_t*)source};
+	size_t sizes[] = {strlen(format) + 1, sizeof(version), sizeof(max),
+			  size};
+
+	for (size_t p = 0; p < sizeof(parts) / sizeof(parts[0]); ++p) {
+		for (size_t i = 0; i < sizes[p]; ++i) {
+			hash ^= parts[p][i];
+			hash *= 0x100000001b3ull;
+		}
+	}
+	return hash;
+}
+
+bool cache_path(char* path, size_t size, const char* dir, uint64_t key)
+{
+	int n = snprintf(path, size, "%s/%016llx.bfc", dir,
+			 (unsigned long long)key);
+	return n > 0 && (size_t)n < size;
+}
+
+/*
+ * The words of a cache file are trusted only once they check out: every
+ * opcode is known, every superinstruction is allowed (`fused`) and followed
+ * by the op it fuses, every operand is in range, every jump lands right
+ * after its partner, the program ends in HALT and no move or offset goes
+ * past the margin the header claims, which sizes the tape's guard.
+ */
+static bool cache_verify(const struct CacheHeader* header,
+			 const uint32_t* words, bool fused)
+{
+	size_t size = header->words;
+	if (size == 0 || words[size - 1] != OpCode_HALT)
+		return false;
+
+	size_t* open = malloc(sizeof(size_t) * size);
+	if (!open)
+		return false;
+
+	size_t depth = 0, reach = 0, travel = 0;
+	bool ok	     = true;
+	for (size_t pc = 0; ok && pc < size;) {
+		uint32_t w   = words[pc];
+		size_t width = 1;
+		uint64_t operand;
+		long offset;
+
+		/*
+		 * A superinstruction checks as its first op; the second keeps
+		 * its own word, which is checked next.
+		 */
+		enum OpCode second;
+		enum OpCode op = superinstruction_split(
+			(enum OpCode)WORD_OPCODE(w), &second);
+		if (second != OpCode_COUNT &&
+		    (!fused || pc + 1 >= size ||
+		     WORD_OPCODE(words[pc + 1]) != second)) {
+			ok = false;
+			break;
+		}
+
+		switch (op) {
+		case OpCode_INC_PTR:
+		case OpCode_DEC_PTR:
+			ok = !__builtin_add_overflow(travel, WORD_OPERAND(w),
+						     &travel);
+			break;
+		case OpCode_SCAN_RIGHT:
+		case OpCode_SCAN_LEFT:
+			ok = WORD_OPERAND(w) != 0 &&
+			     !__builtin_add_overflow(travel, WORD_OPERAND(w),
+						     &travel);
+			break;
+		case OpCode_ADD_VAL:
+		case OpCode_SUB_VAL:
+		case OpCode_OUTPUT:
+		case OpCode_INPUT:
+		case OpCode_SET_VAL:
+		case OpCode_MUL_ADD:
+			offset = WORD_OFFSET(w);
+			if ((size_t)labs(offset) > reach)
+				reach = (size_t)labs(offset);
+			break;
+		case OpCode_JUMP_ZERO:
+		case OpCode_JUMP_ZERO_WIDE:
+			open[depth++] = pc;
+			width = op == OpCode_JUMP_ZERO ? 1 : 3;
+			break;
+		case OpCode_JUMP_NONZERO:
+		case OpCode_JUMP_NONZERO_WIDE: {
+			width = op == OpCode_JUMP_NONZERO ? 1 : 3;
+			if (depth == 0 || pc + width > size) {
+				ok = false;
+				break;
+			}
+			size_t start	= open[--depth];
+			uint32_t head	= words[start];
+			size_t head_end = start + 1;
+			uint64_t target = WORD_OPERAND(head);
+			if (WORD_OPCODE(head) == OpCode_JUMP_ZERO_WIDE) {
+				head_end = start + 3;
+				target	 = bytecode_wide(words + start + 1);
+			}
+			operand = width == 1 ? WORD_OPERAND(w)
+					     : bytecode_wide(words + pc + 1);
+			ok	= operand == head_end && target == pc + width;
+			break;
+		}
+		case OpCode_WRITE_LITERAL:
+			width = 5;
+			if (pc + width > size) {
+				ok = false;
+				break;
+			}
+			operand = bytecode_wide(words + pc + 3);
+			ok	= operand <= header->data_size &&
+			     bytecode_wide(words + pc + 1) <=
+				     header->data_size - operand;
+			break;
+		case OpCode_HALT:
+			break;
+		case OpCode_INC_PTR_WIDE:
+		case OpCode_DEC_PTR_WIDE:
+		case OpCode_SCAN_RIGHT_WIDE:
+		case OpCode_SCAN_LEFT_WIDE:
+			width = 3;
+			if (pc + width > size) {
+				ok = false;
+				break;
+			}
+			operand = bytecode_wide(words + pc + 1);
+			ok	= operand != 0 &&
+			     !__builtin_add_overflow(travel, operand, &travel);
+			break;
+		default:
+			ok = false;
+			break;
+		}
+		pc += width;
+	}
+
+	free(open);
+	return ok && depth == 0 && travel <= header->margin &&
+	       reach == header->margin - travel;
+}
+
+const struct CacheHeader* cache_load(const char* path, uint64_t key,
+				     size_t source_size, bool fused,
+				     struct Bytecode* code)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return nullptr;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 ||
+	    (size_t)st.st_size < sizeof(struct CacheHeader)) {
+		close(fd);
+		return nullptr;
+	}
+
+	size_t size = (size_t)st.st_size;
+	void* map   = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return nullptr;
+
+	const struct CacheHeader* header = map;
+	size_t body = size - sizeof(*header);
+	const uint8_t* words = (const uint8_t*)(header + 1);
+	if (memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+	    header->version != CACHE_VERSION || header->key != key ||
+	    header->source_size != source_size ||
+	    header->words > body / sizeof(uint32_t) ||
+	    header->data_size != body - header->words * sizeof(uint32_t) ||
+	    !cache_verify(header, (const uint32_t*)words, fused)) {
+		munmap(map, size);
+		return nullptr;
+	}
+
+	code->words	     = (uint32_t*)words;
+	code->size	     = header->words;
+	code->word_at	     = nullptr;
+	code->data	     = words + header->words * sizeof(uint32_t);
+	code->map	     = map;
+	code->map_size	     = size;
+	return header;
+}
+
+bool cache_store(const char* path, uint64_t key, size_t source_size,
+		 const struct Program* prog, const struct Bytecode* code)
+{
+	struct CacheHeader header = {.magic	  = CACHE_MAGIC,
+				     .version	  = CACHE_VERSION,
+				     .key	  = key,
+				     .source_size = source_size,
+				     .ops	  = prog->size,
+				     .margin	  = prog->reach + prog->travel,
+				     .words	  = code->size,
+				     .data_size	  = prog->data_size};
+
+	char temp[PATH_MAX];
+	int n = snprintf(temp, sizeof(temp), "%s.XXXXXX", path);
+	if (n < 0 || (size_t)n >= sizeof(temp))
+		return false;
+
+	int fd = mkstemp(temp);
+	if (fd < 0)
+		return false;
+
+	bool ok = write_all(fd, (const uint8_t*)&header, sizeof(header)) &&
+		  write_all(fd, (const uint8_t*)code->words,
+			    code->size * sizeof(uint32_t)) &&
+		  write_all(fd, prog->data, prog->data_size);
+	ok = close(fd) == 0 && ok;
+
+	if (!ok || rename(temp, path) != 0) {
+		unlink(temp);
+		return false;
+	}
+	return true;
+}
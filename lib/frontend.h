@@ -0,0 +1,244 @@
+#ifndef FRONTEND_H
+#define FRONTEND_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bf.h"
+#include "strip.h"
+
+/*
+ * The front end shared by libbf and the engines that link against it:
+ * comment stripping, the parser and its peephole loops, constant prefix
+ * folding and the packed bytecode the interpreters run.  It is linked into
+ * libbf but is not part of its API, so none of it is exported from the
+ * shared library.
+ */
+#pragma GCC visibility push(hidden)
+
+enum OperationType {
+	OperationType_INC_PTR,
+	OperationType_DEC_PTR,
+	OperationType_ADD_VAL,
+	OperationType_SUB_VAL,
+	OperationType_OUTPUT,
+	OperationType_INPUT,
+	OperationType_JUMP_ZERO,
+	OperationType_JUMP_NONZERO,
+	OperationType_SET_VAL,
+	OperationType_MUL_ADD,
+	OperationType_SCAN_RIGHT,
+	OperationType_SCAN_LEFT,
+	OperationType_WRITE_LITERAL,
+	OperationType_HALT
+};
+
+/*
+ * Every op except the pointer moves and jumps addresses the cell `offset`
+ * away from the head, so only INC_PTR/DEC_PTR ever move it.  WRITE_LITERAL
+ * is the exception: it prints `operand` bytes of the program's data
+ * starting at `offset`.
+ */
+struct Instruction {
+	enum OperationType type;
+	size_t operand;
+	long offset;
+};
+
+struct Program {
+	struct Instruction* ops;
+	size_t size;
+	size_t capacity;
+	size_t reach;
+	size_t travel;
+
+	uint8_t* data;
+	size_t data_size;
+
+	/* Source offset each op was compiled from, for --profile. */
+	size_t* source_pos;
+	size_t source_cursor;
+};
+
+/* Pointer moves are deferred at most this far before being flushed. */
+#define MAX_OFFSET 1024
+
+bool program_init(struct Program* prog);
+void program_free(struct Program* prog);
+
+/*
+ * Distance to the first zero among p[0], p[stride], p[2 * stride], ... when
+ * only p[0] .. p[n - 1] may be read; scan_left walks down to p[-(n - 1)].
+ */
+size_t scan_right(const uint8_t* p, size_t n, size_t stride);
+size_t scan_left(const uint8_t* p, size_t n, size_t stride);
+
+/*
+ * Compiles stripped commands onto an initialized `prog`, ending it with
+ * HALT.  Fails with BfStatus_UNMATCHED_OPEN/CLOSE on unbalanced brackets.
+ */
+enum BfStatus compile_source(const char* source, size_t len,
+			     struct Program* prog);
+
+/* Runs the input-independent prefix at compile time; false on ENOMEM. */
+bool fold_constant_prefix(struct Program* prog, size_t limit);
+
+/*
+ * Superinstructions: SUPER(first, second) gives the pair of single-word ops
+ * its own opcode, so a run of both costs one dispatch instead of two.  The
+ * list is data: regenerate it from the "Hottest op pairs" section that
+ * bfblackmagic --profile prints for the programs in tests/.  Only bftail
+ * and bfblackmagic fuse pairs; the other engines never see these opcodes.
+ */
+#define SUPERINSTRUCTIONS(SUPER)     \
+	SUPER(MUL_ADD, SET_VAL)      \
+	SUPER(INC_PTR, MUL_ADD)      \
+	SUPER(SET_VAL, DEC_PTR)      \
+	SUPER(DEC_PTR, JUMP_NONZERO) \
+	SUPER(INC_PTR, JUMP_NONZERO) \
+	SUPER(DEC_PTR, MUL_ADD)      \
+	SUPER(ADD_VAL, INC_PTR)      \
+	SUPER(SUB_VAL, INC_PTR)      \
+	SUPER(MUL_ADD, MUL_ADD)      \
+	SUPER(SET_VAL, ADD_VAL)      \
+	SUPER(SET_VAL, SUB_VAL)      \
+	SUPER(SUB_VAL, JUMP_NONZERO)
+
+/*
+ * The interpreters run a packed form of the Program: one 32-bit word per op,
+ *
+ *   bits 0-7    opcode
+ *   bits 8-15   8-bit value (ADD/SUB/SET amount, MUL_ADD factor)
+ *   bits 16-31  signed cell offset
+ *
+ * or, for moves, scans and jumps, a 24-bit operand in bits 8-31.  Jumps
+ * hold the word index to continue at.  An operand that does not fit uses
+ * the op's _WIDE opcode and a 64-bit operand in the next two words;
+ * WRITE_LITERAL always carries its length and pool offset that way.  The
+ * narrow opcodes share OperationType's numbering.
+ */
+enum OpCode {
+	OpCode_INC_PTR,
+	OpCode_DEC_PTR,
+	OpCode_ADD_VAL,
+	OpCode_SUB_VAL,
+	OpCode_OUTPUT,
+	OpCode_INPUT,
+	OpCode_JUMP_ZERO,
+	OpCode_JUMP_NONZERO,
+	OpCode_SET_VAL,
+	OpCode_MUL_ADD,
+	OpCode_SCAN_RIGHT,
+	OpCode_SCAN_LEFT,
+	OpCode_WRITE_LITERAL,
+	OpCode_HALT,
+	OpCode_INC_PTR_WIDE,
+	OpCode_DEC_PTR_WIDE,
+	OpCode_JUMP_ZERO_WIDE,
+	OpCode_JUMP_NONZERO_WIDE,
+	OpCode_SCAN_RIGHT_WIDE,
+	OpCode_SCAN_LEFT_WIDE,
+#define SUPER_OPCODE(first, second) OpCode_##first##_##second,
+	SUPERINSTRUCTIONS(SUPER_OPCODE)
+#undef SUPER_OPCODE
+	OpCode_COUNT
+};
+
+static_assert(MAX_OFFSET <= INT16_MAX, "cell offsets must fit 16 bits");
+
+#define BYTECODE_NARROW_MAX 0xFFFFFFu
+
+struct Bytecode {
+	uint32_t* words;
+	size_t size;
+
+	/* Word index of every Program op, plus one past the end. */
+	size_t* word_at;
+	const uint8_t* data;
+
+	/* The cache file mapping the words live in, if they came from one. */
+	void* map;
+	size_t map_size;
+};
+
+#define WORD_OPCODE(w) ((w) & 0xFFu)
+#define WORD_VALUE(w) ((uint8_t)((w) >> 8))
+#define WORD_OFFSET(w) ((long)(int16_t)((w) >> 16))
+#define WORD_OPERAND(w) ((size_t)((w) >> 8))
+
+static inline uint64_t bytecode_wide(const uint32_t* words)
+{
+	uint64_t value;
+	memcpy(&value, words, sizeof(value));
+	return value;
+}
+
+bool bytecode_compile(struct Program* prog, struct Bytecode* code);
+void bytecode_free(struct Bytecode* code);
+
+/* Returns the superinstruction for the pair, or OpCode_COUNT if none. */
+enum OpCode superinstruction_of(enum OperationType first,
+				enum OperationType second);
+
+/*
+ * The opposite of superinstruction_of: returns the first op of the pair
+ * `op` fuses and sets *second to the other, or returns `op` itself and
+ * sets *second to OpCode_COUNT if it is not a superinstruction.
+ */
+enum OpCode superinstruction_split(enum OpCode op, enum OpCode* second);
+
+/* Fuses adjacent op pairs into superinstructions; returns how many. */
+size_t bytecode_fuse(const struct Program* prog, struct Bytecode* code);
+
+/* Writes all of `data`, retrying short writes; false on error. */
+bool write_all(int fd, const uint8_t* data, size_t size);
+
+/*
+ * Bytecode cache: one file per source, named after cache_key, holding a
+ * CacheHeader followed by the bytecode words and the literal pool.  A hit
+ * maps the file and runs the words in place, with no compile at all.
+ * Files are written to a temporary name and renamed, so a reader never
+ * sees half of one.
+ */
+struct CacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t key;
+	uint64_t source_size;
+	uint64_t ops;
+	uint64_t margin;
+	uint64_t words;
+	uint64_t data_size;
+};
+
+/*
+ * The format names an engine's opcode set in its keys, so engines never
+ * load each other's files.  Engines that fuse name the superinstructions
+ * too, so regenerating the list invalidates what they cached before.
+ */
+#define CACHE_SUPER_NAME(first, second) " " #first "+" #second
+#define CACHE_FORMAT_FUSED(engine) engine SUPERINSTRUCTIONS(CACHE_SUPER_NAME)
+
+uint64_t cache_key(const char* format, const char* source, size_t size,
+		   size_t limit);
+bool cache_path(char* path, size_t size, const char* dir, uint64_t key);
+
+/*
+ * Maps the cache file for `key` and points `code` into it.  Returns the
+ * header, or nullptr on a miss or on a file that does not check out, in
+ * which case the caller compiles the source as if there were no cache.
+ * Superinstructions only check out for engines that run them (`fused`).
+ */
+const struct CacheHeader* cache_load(const char* path, uint64_t key,
+				     size_t source_size, bool fused,
+				     struct Bytecode* code);
+bool cache_store(const char* path, uint64_t key, size_t source_size,
+		 const struct Program* prog, const struct Bytecode* code);
+
+#pragma GCC visibility pop
+
+#endif
@@ -0,0 +1,611 @@
+#define _GNU_SOURCE
+#include "bf.h"
+#include "frontend.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BF_DEFAULT_LIMIT 30000
+
+/* A context's first tape; it at least doubles whenever a run walks off it. */
+#define CONTEXT_INITIAL_CELLS 1024
+#define CONTEXT_BUFFER_SIZE 4096
+
+struct BfProgram {
+	struct Program program;
+	struct Bytecode code;
+
+	/* Cells [-left, limit) exist, left rounded out like the engines'. */
+	long left;
+	long limit;
+};
+
+/*
+ * Everything a run needs lives here rather than in locals of the
+ * interpreter, so a run that stops can pick up again where it was.  `in`
+ * and `out` are the current run's input and output: the context's own
+ * buffers, refilled and drained through `io`, or the caller's memory under
+ * bf_run_buffers and bf_resume, where `io` is null.  `more_input` says
+ * whether reading past the end of `in` suspends the run (bf_resume before
+ * bf_end_input) or reads end of input.
+ */
+struct BfContext {
+	const struct BfProgram* program;
+
+	/* Cells [lo, hi) are allocated; `cells` points at cell 0. */
+	uint8_t* tape;
+	uint8_t* cells;
+	long lo;
+	long hi;
+
+	size_t pc;
+	long ptr;
+	/* Bytes of the WRITE_LITERAL at pc already written. */
+	size_t literal;
+	uint64_t fuel;
+
+	const struct BfIo* io;
+	const uint8_t* in;
+	size_t in_size;
+	size_t in_pos;
+	bool more_input;
+	bool input_ended;
+	uint8_t* out;
+	size_t out_size;
+	size_t out_cap;
+
+	uint8_t in_buffer[CONTEXT_BUFFER_SIZE];
+	uint8_t out_buffer[CONTEXT_BUFFER_SIZE];
+};
+
+const char* bf_status_message(enum BfStatus status)
+{
+	switch (status) {
+	case BfStatus_OK:
+		return "Success";
+	case BfStatus_UNMATCHED_OPEN:
+		return "Unmatched '['";
+	case BfStatus_UNMATCHED_CLOSE:
+		return "Unmatched ']'";
+	case BfStatus_NO_MEMORY:
+		return "Out of memory";
+	case BfStatus_TAPE_LEFT:
+		return "Tape limit exceeded (Left)";
+	case BfStatus_TAPE_RIGHT:
+		return "Tape limit exceeded (Right)";
+	case BfStatus_OUTPUT_FULL:
+		return "Output buffer full";
+	case BfStatus_NEED_INPUT:
+		return "Waiting for input";
+	case BfStatus_OUT_OF_FUEL:
+		return "Out of fuel";
+	case BfStatus_IO_ERROR:
+		return "Program I/O failed";
+	}
+	return "Unknown status";
+}
+
+enum BfStatus bf_compile(const char* source, size_t size, size_t limit,
+			 struct BfProgram** program)
+{
+	*program = nullptr;
+	if (limit == 0)
+		limit = BF_DEFAULT_LIMIT;
+
+	struct BfProgram* self = calloc(1, sizeof(struct BfProgram));
+	if (!self)
+		return BfStatus_NO_MEMORY;
+	if (!program_init(&self->program)) {
+		free(self);
+		return BfStatus_NO_MEMORY;
+	}
+
+	enum BfStatus status = BfStatus_NO_MEMORY;
+	char* commands	     = malloc(size + STRIP_SLACK);
+	if (commands) {
+		size_t len = strip_comments(source, size, commands);
+		status	   = compile_source(commands, len, &self->program);
+		free(commands);
+	}
+	if (status == BfStatus_OK &&
+	    (!fold_constant_prefix(&self->program, limit) ||
+	     !bytecode_compile(&self->program, &self->code)))
+		status = BfStatus_NO_MEMORY;
+
+	if (status != BfStatus_OK) {
+		program_free(&self->program);
+		free(self);
+		return status;
+	}
+
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	self->limit = (long)limit;
+	self->left  = (long)(((2 * limit + page - 1) & ~(page - 1)) - limit);
+	*program    = self;
+	return BfStatus_OK;
+}
+
+void bf_program_free(struct BfProgram* program)
+{
+	if (!program)
+		return;
+	bytecode_free(&program->code);
+	program_free(&program->program);
+	free(program);
+}
+
+struct BfContext* bf_context_new(const struct BfProgram* program)
+{
+	struct BfContext* self = calloc(1, sizeof(struct BfContext));
+	if (!self)
+		return nullptr;
+
+	long initial = program->limit < CONTEXT_INITIAL_CELLS
+			       ? program->limit
+			       : CONTEXT_INITIAL_CELLS;
+	self->tape = calloc((size_t)initial, 1);
+	if (!self->tape) {
+		free(self);
+		return nullptr;
+	}
+	self->program = program;
+	self->fuel    = BF_FUEL_UNLIMITED;
+	self->cells   = self->tape;
+	self->lo      = 0;
+	self->hi      = initial;
+	return self;
+}
+
+void bf_context_reset(struct BfContext* ctx)
+{
+	memset(ctx->tape, 0, (size_t)(ctx->hi - ctx->lo));
+	ctx->pc	     = 0;
+	ctx->ptr     = 0;
+	ctx->literal	 = 0;
+	ctx->in_size	 = 0;
+	ctx->in_pos	 = 0;
+	ctx->input_ended = false;
+}
+
+void bf_set_fuel(struct BfContext* ctx, uint64_t fuel)
+{
+	ctx->fuel = fuel;
+}
+
+uint64_t bf_fuel(const struct BfContext* ctx)
+{
+	return ctx->fuel;
+}
+
+void bf_context_free(struct BfContext* ctx)
+{
+	if (!ctx)
+		return;
+	free(ctx->tape);
+	free(ctx);
+}
+
+/*
+ * Makes cell `at` exist, growing the tape toward it to at least twice its
+ * size, or says why it cannot.
+ */
+static enum BfStatus context_grow(struct BfContext* self, long at)
+{
+	const struct BfProgram* program = self->program;
+	if (at >= program->limit)
+		return BfStatus_TAPE_RIGHT;
+	if (at < -program->left)
+		return BfStatus_TAPE_LEFT;
+
+	long span = self->hi - self->lo;
+	long lo	  = self->lo;
+	long hi	  = self->hi;
+	if (at >= hi) {
+		hi = hi + span > at ? hi + span : at + 1;
+		if (hi > program->limit)
+			hi = program->limit;
+	} else {
+		lo = lo - span <= at ? lo - span : at;
+		if (lo < -program->left)
+			lo = -program->left;
+	}
+
+	uint8_t* tape = calloc((size_t)(hi - lo), 1);
+	if (!tape)
+		return BfStatus_NO_MEMORY;
+	memcpy(tape + (self->lo - lo), self->tape, (size_t)span);
+	free(self->tape);
+
+	self->tape  = tape;
+	self->cells = tape - lo;
+	self->lo    = lo;
+	self->hi    = hi;
+	return BfStatus_OK;
+}
+
+/* Hands buffered output to io->write; the caller's memory stays put. */
+static enum BfStatus context_flush(struct BfContext* self)
+{
+	const struct BfIo* io = self->io;
+	if (!io)
+		return BfStatus_OK;
+	if (io->write && self->out_size > 0 &&
+	    !io->write(io->user, self->out, self->out_size))
+		return BfStatus_IO_ERROR;
+	self->out_size = 0;
+	return BfStatus_OK;
+}
+
+/* Makes room for at least one more byte of output. */
+static inline enum BfStatus context_room(struct BfContext* self)
+{
+	if (self->out_size < self->out_cap)
+		return BfStatus_OK;
+	if (!self->io)
+		return BfStatus_OUTPUT_FULL;
+	return context_flush(self);
+}
+
+/*
+ * The next input byte, or EOF once there is none.  Sets *status instead
+ * when the run has to stop and wait for more.
+ */
+static int context_input(struct BfContext* self, enum BfStatus* status)
+{
+	const struct BfIo* io = self->io;
+	if (self->in_pos == self->in_size && io && io->read) {
+		if ((*status = context_flush(self)) != BfStatus_OK)
+			return EOF;
+		self->in_pos  = 0;
+		self->in_size = io->read(io->user, self->in_buffer,
+					 sizeof(self->in_buffer));
+	} else if (self->in_pos == self->in_size && self->more_input) {
+		*status = BfStatus_NEED_INPUT;
+		return EOF;
+	}
+	return self->in_pos < self->in_size ? self->in[self->in_pos++] : EOF;
+}
+
+/*
+ * The interpreter proper, on bflist's bytecode.  The head is a cell index
+ * checked on every access: cells outside [lo, hi) are either grown into or
+ * past the limit.  Any stop leaves pc on the op that could not complete,
+ * which has had no effect yet.
+ *
+ * Fuel is only charged at taken back-edges, each for the whole loop body
+ * in words: nested loops charge their own extra trips, and code outside
+ * every loop runs at most once.  That bounds the work done without
+ * counting ops one by one.  Instantiated twice below, so contexts left on
+ * BF_FUEL_UNLIMITED skip the charge altogether.
+ */
+static inline __attribute__((always_inline)) enum BfStatus
+context_exec_body(struct BfContext* self, bool metered)
+{
+	const uint32_t* words = self->program->code.words;
+	const uint8_t* data   = self->program->code.data;
+
+	size_t pc      = self->pc;
+	long ptr       = self->ptr;
+	uint64_t fuel  = self->fuel;
+	uint8_t* cells = self->cells;
+	long lo	       = self->lo;
+	long hi	       = self->hi;
+	long at;
+
+	enum BfStatus status = BfStatus_OK;
+
+#define CELL(offset)                                                      \
+	({                                                                \
+		at = ptr + (offset);                                      \
+		if (at < lo || at >= hi) {                                \
+			if ((status = context_grow(self, at)) !=          \
+			    BfStatus_OK)                                  \
+				goto stop;                                \
+			cells = self->cells;                              \
+			lo    = self->lo;                                 \
+			hi    = self->hi;                                 \
+		}                                                         \
+		&cells[at];                                               \
+	})
+
+	/*
+	 * Left to itself the compiler keeps fuel on the stack, as it is live
+	 * across every call and only used at back-edges, and then each trip
+	 * pays a load and a store.  Demanding it in a register after every
+	 * op and every charge keeps it in one for the whole run.
+	 */
+#define FUEL_KEEP() __asm__("" : "+r"(fuel))
+
+	/*
+	 * Whatever fuel is left buys the next trip, even one that costs
+	 * more, so a slice smaller than a loop body still gets through it.
+	 */
+#define FUEL_CHARGE(cost)                                                 \
+	do {                                                              \
+		if (__builtin_sub_overflow(fuel, (cost), &fuel)) {        \
+			bool empty = fuel + (cost) == 0;                  \
+			fuel	   = 0;                                   \
+			if (empty) {                                      \
+				status = BfStatus_OUT_OF_FUEL;            \
+				goto stop;                                \
+			}                                                 \
+		}                                                         \
+		FUEL_KEEP();                                              \
+	} while (0)
+
+	for (;;) {
+		uint32_t w = words[pc];
+
+		switch ((enum OpCode)WORD_OPCODE(w)) {
+		case OpCode_INC_PTR:
+			ptr += (long)WORD_OPERAND(w);
+			break;
+
+		case OpCode_DEC_PTR:
+			ptr -= (long)WORD_OPERAND(w);
+			break;
+
+		case OpCode_ADD_VAL:
+			*CELL(WORD_OFFSET(w)) += WORD_VALUE(w);
+			break;
+
+		case OpCode_SUB_VAL:
+			*CELL(WORD_OFFSET(w)) -= WORD_VALUE(w);
+			break;
+
+		case OpCode_OUTPUT: {
+			uint8_t c = *CELL(WORD_OFFSET(w));
+			if ((status = context_room(self)) != BfStatus_OK)
+				goto stop;
+			self->out[self->out_size++] = c;
+			break;
+		}
+
+		case OpCode_INPUT: {
+			uint8_t* cell = CELL(WORD_OFFSET(w));
+			int c	      = context_input(self, &status);
+			if (status != BfStatus_OK)
+				goto stop;
+			if (c != EOF)
+				*cell = (uint8_t)c;
+			break;
+		}
+
+		case OpCode_JUMP_ZERO:
+			if (*CELL(0) == 0) {
+				pc = WORD_OPERAND(w);
+				continue;
+			}
+			break;
+
+		case OpCode_JUMP_NONZERO:
+			if (*CELL(0) != 0) {
+				size_t cost = pc + 1 - WORD_OPERAND(w);
+				if (metered)
+					FUEL_CHARGE(cost);
+				pc = WORD_OPERAND(w);
+				continue;
+			}
+			break;
+
+		case OpCode_SET_VAL:
+			*CELL(WORD_OFFSET(w)) = WORD_VALUE(w);
+			break;
+
+		case OpCode_MUL_ADD: {
+			uint8_t value = *CELL(0);
+			*CELL(WORD_OFFSET(w)) += value * WORD_VALUE(w);
+			break;
+		}
+
+		/*
+		 * Cells past the allocated ones are all zero, so a scan that
+		 * runs off them stops on the first one it reaches, which is
+		 * then grown into or is past the limit.
+		 */
+		case OpCode_SCAN_RIGHT: {
+			uint8_t* cell = CELL(0);
+			long distance = (long)scan_right(
+				cell, (size_t)(hi - ptr), WORD_OPERAND(w));
+			(void)CELL(distance);
+			ptr += distance;
+			break;
+		}
+
+		case OpCode_SCAN_LEFT: {
+			uint8_t* cell = CELL(0);
+			long distance = (long)scan_left(
+				cell, (size_t)(ptr - lo) + 1, WORD_OPERAND(w));
+			(void)CELL(-distance);
+			ptr -= distance;
+			break;
+		}
+
+		case OpCode_WRITE_LITERAL: {
+			size_t length = bytecode_wide(words + pc + 1);
+			size_t start  = bytecode_wide(words + pc + 3);
+			while (self->literal < length) {
+				status = context_room(self);
+				if (status != BfStatus_OK)
+					goto stop;
+				size_t room = self->out_cap - self->out_size;
+				size_t n    = length - self->literal;
+				if (n > room)
+					n = room;
+				memcpy(self->out + self->out_size,
+				       data + start + self->literal, n);
+				self->out_size += n;
+				self->literal += n;
+			}
+			self->literal = 0;
+			pc += 4;
+			break;
+		}
+
+		case OpCode_HALT:
+			goto stop;
+
+		case OpCode_INC_PTR_WIDE:
+			ptr += (long)bytecode_wide(words + pc + 1);
+			pc += 2;
+			break;
+
+		case OpCode_DEC_PTR_WIDE:
+			ptr -= (long)bytecode_wide(words + pc + 1);
+			pc += 2;
+			break;
+
+		case OpCode_JUMP_ZERO_WIDE:
+			if (*CELL(0) == 0) {
+				pc = bytecode_wide(words + pc + 1);
+				continue;
+			}
+			pc += 2;
+			break;
+
+		case OpCode_JUMP_NONZERO_WIDE:
+			if (*CELL(0) != 0) {
+				size_t target = bytecode_wide(words + pc + 1);
+				size_t cost   = pc + 3 - target;
+				if (metered)
+					FUEL_CHARGE(cost);
+				pc = target;
+				continue;
+			}
+			pc += 2;
+			break;
+
+		case OpCode_SCAN_RIGHT_WIDE: {
+			uint8_t* cell = CELL(0);
+			long distance = (long)scan_right(
+				cell, (size_t)(hi - ptr),
+				bytecode_wide(words + pc + 1));
+			(void)CELL(distance);
+			ptr += distance;
+			pc += 2;
+			break;
+		}
+
+		case OpCode_SCAN_LEFT_WIDE: {
+			uint8_t* cell = CELL(0);
+			long distance = (long)scan_left(
+				cell, (size_t)(ptr - lo) + 1,
+				bytecode_wide(words + pc + 1));
+			(void)CELL(-distance);
+			ptr -= distance;
+			pc += 2;
+			break;
+		}
+
+		/* Only bftail and bfblackmagic fuse superinstructions. */
+#define SUPER_CASE(first, second) case OpCode_##first##_##second:
+		SUPERINSTRUCTIONS(SUPER_CASE)
+#undef SUPER_CASE
+		case OpCode_COUNT:
+			goto stop;
+		}
+		if (metered)
+			FUEL_KEEP();
+		pc++;
+	}
+
+#undef CELL
+#undef FUEL_CHARGE
+#undef FUEL_KEEP
+
+stop:
+	self->pc   = pc;
+	self->ptr  = ptr;
+	self->fuel = fuel;
+	return status;
+}
+
+static enum BfStatus context_exec_unmetered(struct BfContext* self)
+{
+	return context_exec_body(self, false);
+}
+
+static enum BfStatus context_exec_metered(struct BfContext* self)
+{
+	return context_exec_body(self, true);
+}
+
+static enum BfStatus context_exec(struct BfContext* self)
+{
+	if (self->fuel == BF_FUEL_UNLIMITED)
+		return context_exec_unmetered(self);
+	return context_exec_metered(self);
+}
+
+enum BfStatus bf_run(struct BfContext* ctx, const struct BfIo* io)
+{
+	static const struct BfIo no_io = {0};
+
+	/* Input left over from an earlier bf_run is still the program's. */
+	if (ctx->in != ctx->in_buffer) {
+		ctx->in	     = ctx->in_buffer;
+		ctx->in_size = 0;
+		ctx->in_pos  = 0;
+	}
+	ctx->io		= io ? io : &no_io;
+	ctx->more_input = false;
+	ctx->out	= ctx->out_buffer;
+	ctx->out_cap	= sizeof(ctx->out_buffer);
+	ctx->out_size	= 0;
+
+	enum BfStatus status  = context_exec(ctx);
+	enum BfStatus flushed = context_flush(ctx);
+	ctx->io		      = nullptr;
+	return status != BfStatus_OK ? status : flushed;
+}
+
+enum BfStatus bf_run_buffers(struct BfContext* ctx, const uint8_t* input,
+			     size_t input_size, uint8_t* output,
+			     size_t output_cap, size_t* output_size)
+{
+	ctx->io		= nullptr;
+	ctx->in		= input;
+	ctx->in_size	= input_size;
+	ctx->in_pos	= 0;
+	ctx->more_input = false;
+	ctx->out	= output;
+	ctx->out_cap	= output_cap;
+	ctx->out_size	= 0;
+
+	enum BfStatus status = context_exec(ctx);
+	*output_size	     = ctx->out_size;
+	return status;
+}
+
+enum BfStatus bf_resume(struct BfContext* ctx, const uint8_t* input,
+			size_t input_size, size_t* input_used,
+			uint8_t* output, size_t output_cap,
+			size_t* output_size)
+{
+	ctx->io		= nullptr;
+	ctx->in		= input;
+	ctx->in_size	= input_size;
+	ctx->in_pos	= 0;
+	ctx->more_input = !ctx->input_ended;
+	ctx->out	= output;
+	ctx->out_cap	= output_cap;
+	ctx->out_size	= 0;
+
+	enum BfStatus status = context_exec(ctx);
+	*input_used	     = ctx->in_pos;
+	*output_size	     = ctx->out_size;
+	ctx->in		     = nullptr;
+	ctx->in_size	     = 0;
+	ctx->in_pos	     = 0;
+	return status;
+}
+
+void bf_end_input(struct BfContext* ctx)
+{
+	ctx->input_ended = true;
+}
@@ -0,0 +1,80 @@
+#define _GNU_SOURCE
+#include "source.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool source_load(struct Source* self, const char* filename)
+{
+	bool from_stdin = strcmp(filename, "-") == 0;
+	int fd		= from_stdin ? STDIN_FILENO : open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		size_t size = (size_t)st.st_size;
+		void* map   = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			madvise(map, size, MADV_SEQUENTIAL);
+			if (!from_stdin)
+				close(fd);
+			self->data   = map;
+			self->size   = size;
+			self->mapped = true;
+			return true;
+		}
+	}
+
+	size_t size	= 0;
+	size_t capacity = 65536;
+	char* buffer	= malloc(capacity);
+	bool ok		= buffer != nullptr;
+	while (ok) {
+		if (size == capacity) {
+			char* grown = realloc(buffer, capacity * 2);
+			if (!(ok = grown != nullptr))
+				break;
+			buffer = grown;
+			capacity *= 2;
+		}
+
+		ssize_t n = read(fd, buffer + size, capacity - size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			ok = n == 0;
+			break;
+		}
+		size += (size_t)n;
+	}
+
+	int saved = errno;
+	if (!from_stdin)
+		close(fd);
+	if (!ok) {
+		free(buffer);
+		errno = saved;
+		return false;
+	}
+
+	self->data   = buffer;
+	self->size   = size;
+	self->mapped = false;
+	return true;
+}
+
+void source_free(struct Source* self)
+{
+	if (self->mapped)
+		munmap((void*)self->data, self->size);
+	else
+		free((void*)self->data);
+	self->data = nullptr;
+	self->size = 0;
+}
@@ -0,0 +1,28 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Program text, with its length known up front and no terminating NUL.
+ * Regular files are mapped read-only rather than copied; pipes, terminals
+ * and "-" (stdin) cannot be mapped and are streamed into a buffer instead.
+ * Every front end loads its files this way, so it lives in libbf.a too,
+ * outside the library's API.
+ */
+#pragma GCC visibility push(hidden)
+
+struct Source {
+	const char* data;
+	size_t size;
+	bool mapped;
+};
+
+/* Fails with errno set, for the caller to report. */
+bool source_load(struct Source* self, const char* filename);
+void source_free(struct Source* self);
+
+#pragma GCC visibility pop
+
+#endif
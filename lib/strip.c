@@ -0,0 +1,130 @@
+#include "strip.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Comment stripping: copies only the eight command bytes of a source into
+ * `out`, which needs room for `len + STRIP_SLACK` bytes, and returns how
+ * many there were.  compile_source then runs on dense commands and never
+ * branches on a comment byte.  The vector paths are picked at run time, so
+ * one binary uses AVX2 where the CPU has it.
+ */
+static inline bool is_command(char c)
+{
+	switch (c) {
+	case '>':
+	case '<':
+	case '+':
+	case '-':
+	case '.':
+	case ',':
+	case '[':
+	case ']':
+		return true;
+	default:
+		return false;
+	}
+}
+
+static size_t strip_scalar(const char* src, size_t len, char* out)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < len; ++i) {
+		out[n] = src[i];
+		n += is_command(src[i]);
+	}
+	return n;
+}
+
+#if defined(__x86_64__)
+/* One bit per byte of `v` that is a command. */
+#define STRIP_CLASSIFY(set1, cmpeq, any, v)                     \
+	any(any(any(cmpeq(v, set1('>')), cmpeq(v, set1('<'))),  \
+	        any(cmpeq(v, set1('+')), cmpeq(v, set1('-')))), \
+	    any(any(cmpeq(v, set1('.')), cmpeq(v, set1(','))),  \
+	        any(cmpeq(v, set1('[')), cmpeq(v, set1(']')))))
+
+/* SSE2 has no byte shuffle, so mixed blocks are copied bit by bit. */
+static __attribute__((target("sse2"))) size_t strip_sse2(const char* src,
+							 size_t len, char* out)
+{
+	size_t n = 0, i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i v     = _mm_loadu_si128((const __m128i*)(src + i));
+		uint32_t mask = (uint32_t)_mm_movemask_epi8(STRIP_CLASSIFY(
+			_mm_set1_epi8, _mm_cmpeq_epi8, _mm_or_si128, v));
+		if (mask == 0xFFFF) {
+			_mm_storeu_si128((__m128i*)(out + n), v);
+			n += 16;
+			continue;
+		}
+		while (mask) {
+			out[n++] = src[i + (size_t)__builtin_ctz(mask)];
+			mask &= mask - 1;
+		}
+	}
+	return n + strip_scalar(src + i, len - i, out + n);
+}
+
+/*
+ * Each 8-byte quarter of a mixed block is packed with one pshufb, whose
+ * control comes from `shuffle`: for every 8-bit mask, the indexes of its
+ * set bits, in order.
+ */
+static __attribute__((target("avx2"))) size_t strip_avx2(const char* src,
+							 size_t len, char* out)
+{
+	uint8_t shuffle[256][16];
+	for (unsigned m = 0; m < 256; ++m) {
+		unsigned k = 0;
+		for (unsigned b = 0; b < 8; ++b) {
+			if (m & (1u << b))
+				shuffle[m][k++] = (uint8_t)b;
+		}
+		while (k < 16)
+			shuffle[m][k++] = 0x80;
+	}
+
+	size_t n = 0, i = 0;
+	for (; i + 32 <= len; i += 32) {
+		__m256i v     = _mm256_loadu_si256((const __m256i*)(src + i));
+		uint32_t mask = (uint32_t)_mm256_movemask_epi8(STRIP_CLASSIFY(
+			_mm256_set1_epi8, _mm256_cmpeq_epi8, _mm256_or_si256,
+			v));
+		if (mask == 0)
+			continue;
+		if (mask == 0xFFFFFFFFu) {
+			_mm256_storeu_si256((__m256i*)(out + n), v);
+			n += 32;
+			continue;
+		}
+		for (size_t q = 0; q < 4; ++q) {
+			unsigned m  = (mask >> (q * 8)) & 0xFF;
+			__m128i raw = _mm_loadl_epi64(
+				(const __m128i*)(src + i + q * 8));
+			__m128i ctl = _mm_loadu_si128((const __m128i*)shuffle[m]);
+			_mm_storel_epi64((__m128i*)(out + n),
+					 _mm_shuffle_epi8(raw, ctl));
+			n += (size_t)__builtin_popcount(m);
+		}
+	}
+	return n + strip_scalar(src + i, len - i, out + n);
+}
+#endif
+
+size_t strip_comments(const char* src, size_t len, char* out)
+{
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2"))
+		return strip_avx2(src, len, out);
+	return strip_sse2(src, len, out);
+#else
+	return strip_scalar(src, len, out);
+#endif
+}
@@ -0,0 +1,20 @@
+#ifndef STRIP_H
+#define STRIP_H
+
+#include <stddef.h>
+
+/*
+ * Copies only the eight command bytes of a source into `out`, which needs
+ * room for `len + STRIP_SLACK` bytes, and returns how many there were.
+ * Kept apart from the rest of the front end so bfopt, which parses with
+ * its own IR, can link it alone.
+ */
+#pragma GCC visibility push(hidden)
+
+#define STRIP_SLACK 32
+
+size_t strip_comments(const char* src, size_t len, char* out);
+
+#pragma GCC visibility pop
+
+#endif
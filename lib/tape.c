@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "tape.h"
+
+/* Per thread, so every --batch worker faults into its own tape. */
+static thread_local struct Tap* tap_current;
+
+static inline uintptr_t page_floor(uintptr_t addr, size_t page)
+{
+	return addr & ~(uintptr_t)(page - 1);
+}
+
+static inline uintptr_t page_ceil(uintptr_t addr, size_t page)
+{
+	return page_floor(addr + page - 1, page);
+}
+
+/*
+ * A fault inside the tape's reservation either lands between the committed
+ * pages and the limit, in which case the committed range grows (at least
+ * doubling) to cover it and the access is retried, or past the limit, in
+ * which case we unwind to whoever is running the program.  Anything else is
+ * a genuine crash and gets the default action.
+ */
+static void tap_fault(int sig, siginfo_t* info, void* context)
+{
+	(void)context;
+
+	struct Tap* self = tap_current;
+	uintptr_t addr	 = (uintptr_t)info->si_addr;
+
+	if (!self || addr < (uintptr_t)self->map ||
+	    addr >= (uintptr_t)self->map + self->map_size) {
+		signal(sig, SIG_DFL);
+		return;
+	}
+
+	if (addr >= (uintptr_t)self->ceil) {
+		self->fault = TapFault_RIGHT;
+		siglongjmp(self->escape, 1);
+	}
+	if (addr < (uintptr_t)self->floor) {
+		self->fault = TapFault_LEFT;
+		siglongjmp(self->escape, 1);
+	}
+
+	uintptr_t lo   = (uintptr_t)self->lo;
+	uintptr_t hi   = (uintptr_t)self->hi;
+	uintptr_t span = hi - lo;
+
+	if (addr >= hi) {
+		hi = hi + span > addr ? hi + span : page_ceil(addr + 1, self->page);
+		if (hi > (uintptr_t)self->ceil)
+			hi = (uintptr_t)self->ceil;
+	} else if (addr < lo) {
+		lo = lo - (uintptr_t)self->floor > span
+			     ? lo - span
+			     : (uintptr_t)self->floor;
+		if (lo > addr)
+			lo = page_floor(addr, self->page);
+	} else {
+		signal(sig, SIG_DFL);
+		return;
+	}
+
+	if (mprotect((void*)lo, hi - lo, PROT_READ | PROT_WRITE) != 0) {
+		self->fault = TapFault_MEMORY;
+		siglongjmp(self->escape, 1);
+	}
+	self->lo = (uint8_t*)lo;
+	self->hi = (uint8_t*)hi;
+}
+
+/*
+ * The tape is a PROT_NONE reservation with cells [-limit, limit) in the
+ * middle (the left end is rounded out to a page) and at least `margin`
+ * cells of guard on either side, `margin` being the furthest the program
+ * can get from the last cell it touched.  Cells are committed lazily by
+ * tap_fault, and walking off either end faults into the guard, so the
+ * interpreters move the head with plain pointer arithmetic.
+ */
+bool tap_init(struct Tap* self, size_t initial_size, size_t limit,
+	      size_t margin)
+{
+	self->page	= (size_t)sysconf(_SC_PAGESIZE);
+	self->limit	= limit;
+	self->fault	= TapFault_NONE;
+
+	size_t guard	= page_ceil(margin + MAX_OFFSET, self->page);
+	size_t usable	= page_ceil(2 * limit, self->page);
+	self->map_size	= guard + usable + guard;
+	self->map	= mmap(nullptr, self->map_size, PROT_NONE,
+			       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1,
+			       0);
+	if (self->map == MAP_FAILED) {
+		self->map = nullptr;
+		return false;
+	}
+
+	self->floor = self->map + guard;
+	self->ceil  = self->floor + usable;
+	self->cells = self->ceil - limit;
+
+	size_t initial = initial_size < limit ? initial_size : limit;
+	uintptr_t lo   = page_floor((uintptr_t)(self->cells - initial), self->page);
+	uintptr_t hi   = page_ceil((uintptr_t)(self->cells + initial), self->page);
+	if (lo < (uintptr_t)self->floor)
+		lo = (uintptr_t)self->floor;
+	self->lo = (uint8_t*)lo;
+	self->hi = (uint8_t*)hi;
+
+	if (mprotect(self->lo, hi - lo, PROT_READ | PROT_WRITE) != 0) {
+		munmap(self->map, self->map_size);
+		self->map = nullptr;
+		return false;
+	}
+
+	struct sigaction action = {.sa_sigaction = tap_fault,
+				   .sa_flags	 = SA_SIGINFO};
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGSEGV, &action, nullptr) != 0) {
+		munmap(self->map, self->map_size);
+		self->map = nullptr;
+		return false;
+	}
+
+	tap_current = self;
+	return true;
+}
+
+void tap_deinit(struct Tap* self)
+{
+	if (self->map)
+		munmap(self->map, self->map_size);
+	self->map   = nullptr;
+	tap_current = nullptr;
+}
+
+/*
+ * Zeroes every committed cell for the next run; the committed range stays,
+ * so a tape that grew once does not fault its way back up again.
+ */
+void tap_reset(struct Tap* self)
+{
+	madvise(self->lo, (size_t)(self->hi - self->lo), MADV_DONTNEED);
+	self->fault = TapFault_NONE;
+	tap_current = self;
+}
+
+void tap_escape(struct Tap* self, enum TapFault fault)
+{
+	self->fault = fault;
+	siglongjmp(self->escape, 1);
+}
+
+/* Reports why the program unwound out of its run, if it did. */
+void tap_report_fault(enum TapFault fault)
+{
+	switch (fault) {
+	case TapFault_RIGHT:
+		fprintf(stderr, "Error: Tape limit exceeded (Right).\n");
+		break;
+	case TapFault_LEFT:
+		fprintf(stderr, "Error: Tape limit exceeded (Left).\n");
+		break;
+	case TapFault_MEMORY:
+		fprintf(stderr, "Error: Out of memory for tape.\n");
+		break;
+	case TapFault_NONE:
+		break;
+	}
+}
+
+bool output_flush(struct Output* self)
+{
+	bool ok	   = write_all(self->fd, self->data, self->size);
+	self->size = 0;
+	return ok;
+}
+
+bool output_write(struct Output* self, const uint8_t* data, size_t size)
+{
+	if (self->size + size > OUTPUT_BUFFER_SIZE) {
+		if (!output_flush(self))
+			return false;
+		if (size > OUTPUT_BUFFER_SIZE)
+			return write_all(self->fd, data, size);
+	}
+
+	memcpy(self->data + self->size, data, size);
+	self->size += size;
+	if (self->line_buffered && memchr(data, '\n', size))
+		return output_flush(self);
+	return true;
+}
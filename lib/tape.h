@@ -0,0 +1,150 @@
+#ifndef TAPE_H
+#define TAPE_H
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "frontend.h"
+
+/*
+ * The runtime shared by the native engines: the guard-page tape bflist,
+ * bftail and bfblackmagic run on, the faults it reports, and buffered
+ * program I/O.  Like the front end it is linked into libbf.a but kept out
+ * of the library's API.
+ */
+#pragma GCC visibility push(hidden)
+
+enum TapFault {
+	TapFault_NONE,
+	TapFault_RIGHT,
+	TapFault_LEFT,
+	TapFault_MEMORY
+};
+
+struct Tap {
+	uint8_t* map;
+	size_t map_size;
+	size_t page;
+
+	uint8_t* cells;
+	uint8_t* floor;
+	uint8_t* ceil;
+
+	uint8_t* lo;
+	uint8_t* hi;
+
+	size_t limit;
+
+	enum TapFault fault;
+	sigjmp_buf escape;
+};
+
+static inline uint8_t* tap_get_ptr(struct Tap* self)
+{
+	return self->cells;
+}
+
+/*
+ * Maps a tape of `limit` cells either side of cell 0 with room for the
+ * program to get `margin` cells past the last one it touched, and makes it
+ * the calling thread's: a fault past the limit sets `fault` and
+ * siglongjmps to `escape`, which the caller must have set up beforehand.
+ */
+bool tap_init(struct Tap* self, size_t initial_size, size_t limit,
+	      size_t margin);
+void tap_deinit(struct Tap* self);
+void tap_reset(struct Tap* self);
+
+/* Prints the engines' error for `fault`, if there is one. */
+void tap_report_fault(enum TapFault fault);
+
+/*
+ * Unwinds out of the run with `fault`, as tap_fault does, for the limits
+ * the engines check themselves instead of leaving to the guard pages.
+ */
+__attribute__((noreturn, cold)) void tap_escape(struct Tap* self,
+						enum TapFault fault);
+
+/*
+ * The head cell is read first so a head sitting past the limit faults
+ * before the distance to the end of the tape is computed.  A scan that
+ * finds no zero before the end of the tape would land past it, possibly
+ * beyond the guard, so it faults there rather than moving the head.
+ */
+static inline uint8_t* tap_scan_right(struct Tap* self, uint8_t* ptr,
+				      size_t stride)
+{
+	if (*ptr == 0)
+		return ptr;
+
+	size_t room	= (size_t)(self->ceil - ptr);
+	size_t distance = scan_right(ptr, room, stride);
+	if (distance >= room)
+		tap_escape(self, TapFault_RIGHT);
+	return ptr + distance;
+}
+
+static inline uint8_t* tap_scan_left(struct Tap* self, uint8_t* ptr,
+				     size_t stride)
+{
+	if (*ptr == 0)
+		return ptr;
+
+	size_t room	= (size_t)(ptr - self->floor) + 1;
+	size_t distance = scan_left(ptr, room, stride);
+	if (distance >= room)
+		tap_escape(self, TapFault_LEFT);
+	return ptr - distance;
+}
+
+#define OUTPUT_BUFFER_SIZE 65536
+
+/*
+ * Program output is collected here and handed to write(2) in bulk: when the
+ * buffer fills, before every input op, at the end of the run and, with
+ * --line-buffered, after every newline.
+ */
+struct Output {
+	uint8_t data[OUTPUT_BUFFER_SIZE];
+	size_t size;
+	int fd;
+	bool line_buffered;
+};
+
+bool output_flush(struct Output* self);
+bool output_write(struct Output* self, const uint8_t* data, size_t size);
+
+static inline bool output_put(struct Output* self, uint8_t c)
+{
+	self->data[self->size++] = c;
+	if (self->size == OUTPUT_BUFFER_SIZE ||
+	    (self->line_buffered && c == '\n'))
+		return output_flush(self);
+	return true;
+}
+
+/*
+ * Where INPUT reads from: stdin when `data` is null (flushing the output
+ * first, so prompts show up), otherwise an in-memory --batch input.
+ */
+struct Input {
+	const uint8_t* data;
+	size_t size;
+	size_t pos;
+};
+
+static inline int input_get(struct Input* self, struct Output* out)
+{
+	if (!self->data) {
+		output_flush(out);
+		return getchar();
+	}
+	return self->pos < self->size ? self->data[self->pos++] : EOF;
+}
+
+#pragma GCC visibility pop
+
+#endif
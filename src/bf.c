@@ -1,3 +1,6 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <limits.h>
 #include <stdbool.h>
@@ -6,6 +9,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "source.h"
 
 struct Node {
 	struct Node* prev;
@@ -43,7 +51,8 @@ struct Node* create_chunk(size_t count)
 	return cells;
 }
 
-bool tap_init(struct Tap* self, const char* codes, int initial_size)
+bool tap_init(struct Tap* self, const char* codes, size_t code_length,
+	      int initial_size)
 {
 	struct Node* cells = create_chunk(initial_size);
 	if (!cells)
@@ -54,7 +63,7 @@ bool tap_init(struct Tap* self, const char* codes, int initial_size)
 
 	self->cell	  = &cells[initial_size / 2];
 	self->codes	  = codes;
-	self->code_length = strlen(codes);
+	self->code_length = code_length;
 	self->pc	  = 0;
 	return true;
 }
@@ -158,15 +167,56 @@ bool tap_decrement(struct Tap* self)
 	return true;
 }
 
-bool tap_output(struct Tap* self)
+#define OUTPUT_BUFFER_SIZE 65536
+
+/*
+ * Program output is collected here and handed to write(2) in bulk: when the
+ * buffer fills, before every input op, at the end of the run and, with
+ * --line-buffered, after every newline.
+ */
+struct Output {
+	uint8_t data[OUTPUT_BUFFER_SIZE];
+	size_t size;
+	int fd;
+	bool line_buffered;
+};
+
+bool output_flush(struct Output* self)
 {
-	if (putchar(self->cell->data) == EOF)
-		return false;
+	size_t done = 0;
+	while (done < self->size) {
+		ssize_t n = write(self->fd, self->data + done, self->size - done);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			self->size = 0;
+			return false;
+		}
+		done += (size_t)n;
+	}
+	self->size = 0;
 	return true;
 }
 
-bool tap_input(struct Tap* self)
+static inline bool output_put(struct Output* self, uint8_t c)
 {
+	self->data[self->size++] = c;
+	if (self->size == OUTPUT_BUFFER_SIZE ||
+	    (self->line_buffered && c == '\n'))
+		return output_flush(self);
+	return true;
+}
+
+bool tap_output(struct Tap* self, struct Output* out)
+{
+	return output_put(out, self->cell->data);
+}
+
+bool tap_input(struct Tap* self, struct Output* out)
+{
+	if (!output_flush(out))
+		return false;
+
 	int c = getchar();
 	if (c != EOF)
 		self->cell->data = (uint8_t)c;
@@ -212,7 +262,7 @@ enum LoopResult tap_jump_back(struct Tap* self)
 	return LoopResult_OK;
 }
 
-void tap_run(struct Tap* self)
+void tap_run(struct Tap* self, struct Output* out)
 {
 	while (self->pc < self->code_length) {
 		char c	= self->codes[self->pc];
@@ -232,10 +282,10 @@ void tap_run(struct Tap* self)
 			ok = tap_decrement(self);
 			break;
 		case '.':
-			ok = tap_output(self);
+			ok = tap_output(self, out);
 			break;
 		case ',':
-			ok = tap_input(self);
+			ok = tap_input(self, out);
 			break;
 		case '[':
 			if (self->cell->data == 0) {
@@ -271,28 +321,10 @@ void tap_run(struct Tap* self)
 	}
 }
 
-char* read_file(const char* filename)
-{
-	FILE* f = fopen(filename, "rb");
-	if (!f)
-		return nullptr;
-
-	fseek(f, 0, SEEK_END);
-	long length = ftell(f);
-	fseek(f, 0, SEEK_SET);
-
-	char* buffer = malloc(length + 1);
-	if (buffer) {
-		fread(buffer, 1, length, f);
-		buffer[length] = '\0';
-	}
-	fclose(f);
-	return buffer;
-}
-
 struct Config {
 	int tape_size;
 	bool verbose;
+	bool line_buffered;
 	const char* filename;
 };
 
@@ -301,6 +333,8 @@ void print_usage(const char* prog_name)
 	printf("Usage: %s [options] <file>\n", prog_name);
 	printf("  -h, --help           Show help\n");
 	printf("  -v, --verbose        Verbose output\n");
+	printf("  -l, --line-buffered  Flush program output at every "
+	       "newline\n");
 	printf("  -s, --size <bytes>   Initial tape size\n");
 }
 
@@ -308,15 +342,17 @@ int main(int argc, char* argv[])
 {
 	struct Config config = {
 		.tape_size = 1024, .verbose = false, .filename = nullptr};
+	static struct Output output = {.fd = STDOUT_FILENO};
 
 	static const struct option long_options[] = {
 		{"help", no_argument, 0, 'h'},
 		{"verbose", no_argument, 0, 'v'},
+		{"line-buffered", no_argument, 0, 'l'},
 		{"size", required_argument, 0, 's'},
 		{0}};
 
 	int opt;
-	while ((opt = getopt_long(argc, argv, "hvs:", long_options, nullptr)) !=
+	while ((opt = getopt_long(argc, argv, "hvls:", long_options, nullptr)) !=
 	       -1) {
 		switch (opt) {
 		case 'h':
@@ -325,6 +361,9 @@ int main(int argc, char* argv[])
 		case 'v':
 			config.verbose = true;
 			break;
+		case 'l':
+			config.line_buffered = true;
+			break;
 		case 's':
 			config.tape_size = atoi(optarg);
 			break;
@@ -344,24 +383,28 @@ int main(int argc, char* argv[])
 	if (config.verbose)
 		printf("Loading %s...\n", config.filename);
 
-	char* codes = read_file(config.filename);
-	if (!codes) {
+	struct Source source;
+	if (!source_load(&source, config.filename)) {
 		perror("Failed to read file");
 		return EXIT_FAILURE;
 	}
 
 	struct Tap tap;
-	if (!tap_init(&tap, codes, config.tape_size)) {
+	if (!tap_init(&tap, source.data, source.size, config.tape_size)) {
 		fprintf(stderr, "Failed to initialize tap.\n");
-		free(codes);
+		source_free(&source);
 		return EXIT_FAILURE;
 	}
 
 	if (config.verbose)
 		printf("Running...\n");
-	tap_run(&tap);
+	fflush(stdout);
+
+	output.line_buffered = config.line_buffered;
+	tap_run(&tap, &output);
+	output_flush(&output);
 
-	free(codes);
+	source_free(&source);
 	tap_deinit(&tap);
 	return EXIT_SUCCESS;
 }
\ No newline at end of file
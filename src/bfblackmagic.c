@@ -1,368 +1,1101 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <limits.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "frontend.h"
+#include "source.h"
+#include "tape.h"
+
+/* Names this engine's opcode set in its bytecode cache keys. */
+#define CACHE_FORMAT CACHE_FORMAT_FUSED("bfblackmagic")
+
+#define PROFILE_TOP 10
+
+static const char* const operation_names[] = {
+	[OperationType_INC_PTR]	      = "INC_PTR",
+	[OperationType_DEC_PTR]	      = "DEC_PTR",
+	[OperationType_ADD_VAL]	      = "ADD_VAL",
+	[OperationType_SUB_VAL]	      = "SUB_VAL",
+	[OperationType_OUTPUT]	      = "OUTPUT",
+	[OperationType_INPUT]	      = "INPUT",
+	[OperationType_JUMP_ZERO]     = "JUMP_ZERO",
+	[OperationType_JUMP_NONZERO]  = "JUMP_NONZERO",
+	[OperationType_SET_VAL]	      = "SET_VAL",
+	[OperationType_MUL_ADD]	      = "MUL_ADD",
+	[OperationType_SCAN_RIGHT]    = "SCAN_RIGHT",
+	[OperationType_SCAN_LEFT]     = "SCAN_LEFT",
+	[OperationType_WRITE_LITERAL] = "WRITE_LITERAL",
+	[OperationType_HALT]	      = "HALT",
+};
 
-struct Tap {
-	uint8_t* right;
-	size_t right_cap;
+/* Prints "line:col" for a byte offset into the source. */
+void profile_print_position(FILE* f, const char* source, size_t pos)
+{
+	size_t line = 1, col = 1;
+	for (size_t i = 0; i < pos; ++i) {
+		if (source[i] == '\n') {
+			line++;
+			col = 1;
+		} else {
+			col++;
+		}
+	}
 
-	uint8_t* left;
-	size_t left_cap;
+	char text[32];
+	snprintf(text, sizeof(text), "%zu:%zu", line, col);
+	fprintf(f, "%-10s", text);
+}
 
-	long pos;
+/* The first few commands starting at `pos`, comments dropped. */
+void profile_print_snippet(FILE* f, const char* source, size_t size,
+			   size_t pos)
+{
+	size_t shown = 0;
+	for (size_t i = pos; i < size; ++i) {
+		if (!strchr("<>+-.,[]", source[i]))
+			continue;
+		if (shown == 40) {
+			fputs("...", f);
+			break;
+		}
+		fputc(source[i], f);
+		shown++;
+	}
+	fputc('\n', f);
+}
 
-	size_t limit;
-};
+/* Picks the indexes of the PROFILE_TOP largest scores, largest first. */
+size_t profile_top(const uint64_t* score, size_t n, size_t* top)
+{
+	size_t count = 0;
+	for (size_t k = 0; k < n; ++k) {
+		if (score[k] == 0)
+			continue;
+
+		size_t at = count < PROFILE_TOP ? count++ : PROFILE_TOP;
+		if (at == PROFILE_TOP && score[k] <= score[top[at - 1]])
+			continue;
+		if (at == PROFILE_TOP)
+			at--;
+		while (at > 0 && score[top[at - 1]] < score[k]) {
+			top[at] = top[at - 1];
+			at--;
+		}
+		top[at] = k;
+	}
+	return count;
+}
 
-enum OperationType {
-	OperationType_INC_PTR,
-	OperationType_DEC_PTR,
-	OperationType_ADD_VAL,
-	OperationType_SUB_VAL,
-	OperationType_OUTPUT,
-	OperationType_INPUT,
-	OperationType_JUMP_ZERO,
-	OperationType_JUMP_NONZERO,
-	OperationType_SET_ZERO,
-	OperationType_HALT
-};
+/*
+ * Counts how often each pair of op types runs back to back where
+ * bytecode_fuse could merge them: the first op is not a jump, so it always
+ * falls through and the pair runs counts[k] times, and the second op is not
+ * a jump target.  SUPERINSTRUCTIONS is picked from this table.
+ */
+bool profile_report_pairs(struct Program* prog, const uint64_t* counts,
+			  uint64_t total, FILE* f)
+{
+	enum { TYPES = OperationType_HALT + 1 };
 
-struct Instruction {
-	enum OperationType type;
-	size_t operand;
-};
+	uint64_t* pairs = calloc(TYPES * TYPES, sizeof(uint64_t));
+	bool* target	= calloc(prog->size + 1, sizeof(bool));
+	if (!pairs || !target) {
+		free(pairs);
+		free(target);
+		return false;
+	}
 
-struct Program {
-	struct Instruction* ops;
-	size_t size;
-	size_t capacity;
-};
+	for (size_t k = 0; k < prog->size; ++k) {
+		enum OperationType type = prog->ops[k].type;
+		if (type == OperationType_JUMP_ZERO ||
+		    type == OperationType_JUMP_NONZERO)
+			target[prog->ops[k].operand + 1] = true;
+	}
 
-static inline uint8_t* tap_get_ptr(struct Tap* self)
-{
-	if (self->pos >= 0) {
-		return &self->right[self->pos];
-	} else {
-		return &self->left[~self->pos];
+	for (size_t k = 0; k + 1 < prog->size; ++k) {
+		enum OperationType first  = prog->ops[k].type;
+		enum OperationType second = prog->ops[k + 1].type;
+		if (first == OperationType_JUMP_ZERO ||
+		    first == OperationType_JUMP_NONZERO || target[k + 1])
+			continue;
+		pairs[first * TYPES + second] += counts[k];
+	}
+
+	size_t top[PROFILE_TOP + 1];
+	size_t n = profile_top(pairs, TYPES * TYPES, top);
+
+	fprintf(f, "\nHottest op pairs:\n");
+	fprintf(f, "  %-29s %16s %6s\n", "pair", "executions", "share");
+	for (size_t t = 0; t < n; ++t) {
+		size_t first  = top[t] / TYPES;
+		size_t second = top[t] % TYPES;
+		fprintf(f, "  %-14s %-14s %16llu %5.1f%%%s\n",
+			operation_names[first], operation_names[second],
+			(unsigned long long)pairs[top[t]],
+			total ? 100.0 * (double)pairs[top[t]] / (double)total
+			      : 0.0,
+			superinstruction_of(first, second) != OpCode_COUNT
+				? "  fused"
+				: "");
 	}
+
+	free(pairs);
+	free(target);
+	return true;
 }
 
-bool tap_init(struct Tap* self, size_t initial_size, size_t limit)
+/*
+ * Loops are charged with every op executed between their brackets, nested
+ * loops included; a loop's iterations are the executions of its first body
+ * op, which is where both the entry and the back-edge land.
+ */
+bool profile_report(struct Program* prog, const uint64_t* counts,
+		    const char* source, size_t size, FILE* f)
 {
-	self->right = calloc(initial_size, sizeof(uint8_t));
-	self->left  = calloc(initial_size, sizeof(uint8_t));
-
-	if (!self->right || !self->left) {
-		if (self->right)
-			free(self->right);
-		if (self->left)
-			free(self->left);
+	uint64_t* prefix = malloc(sizeof(uint64_t) * (prog->size + 1));
+	uint64_t* inside = calloc(prog->size, sizeof(uint64_t));
+	if (!prefix || !inside) {
+		free(prefix);
+		free(inside);
 		return false;
 	}
 
-	self->right_cap = initial_size;
-	self->left_cap	= initial_size;
-	self->limit	= limit;
-	self->pos	= 0;
+	prefix[0] = 0;
+	for (size_t k = 0; k < prog->size; ++k)
+		prefix[k + 1] = prefix[k] + counts[k];
+
+	for (size_t k = 0; k < prog->size; ++k) {
+		if (prog->ops[k].type == OperationType_JUMP_ZERO)
+			inside[k] = prefix[prog->ops[k].operand + 1] - prefix[k];
+	}
+
+	uint64_t total = prefix[prog->size];
+	size_t top[PROFILE_TOP + 1];
+
+	fprintf(f, "\nProfile: %llu ops executed\n",
+		(unsigned long long)total);
+
+	fprintf(f, "\nHottest loops:\n");
+	fprintf(f, "  %-10s %12s %14s %16s %6s  %s\n", "source", "entries",
+		"iterations", "ops inside", "share", "code");
+	size_t n = profile_top(inside, prog->size, top);
+	for (size_t t = 0; t < n; ++t) {
+		size_t k = top[t];
+		fprintf(f, "  ");
+		profile_print_position(f, source, prog->source_pos[k]);
+		fprintf(f, " %12llu %14llu %16llu %5.1f%%  ",
+			(unsigned long long)counts[k],
+			(unsigned long long)counts[k + 1],
+			(unsigned long long)inside[k],
+			total ? 100.0 * (double)inside[k] / (double)total : 0.0);
+		profile_print_snippet(f, source, size, prog->source_pos[k]);
+	}
+
+	fprintf(f, "\nHottest ops:\n");
+	fprintf(f, "  %-10s %-14s %16s %6s  %s\n", "source", "op", "executions",
+		"share", "code");
+	n = profile_top(counts, prog->size, top);
+	for (size_t t = 0; t < n; ++t) {
+		size_t k = top[t];
+		fprintf(f, "  ");
+		profile_print_position(f, source, prog->source_pos[k]);
+		fprintf(f, " %-14s %16llu %5.1f%%  ",
+			operation_names[prog->ops[k].type],
+			(unsigned long long)counts[k],
+			total ? 100.0 * (double)counts[k] / (double)total : 0.0);
+		profile_print_snippet(f, source, size, prog->source_pos[k]);
+	}
+
+	profile_report_pairs(prog, counts, total, f);
+
+	free(prefix);
+	free(inside);
 	return true;
 }
 
-void tap_deinit(struct Tap* self)
+/*
+ * Under --profile every dispatch goes through profile_table, whose entries
+ * all lead to CASE_PROFILE: it bumps the op's counter and continues through
+ * the real dispatch_table.  Normal runs never touch it.
+ */
+static void tap_exec(struct Tap* self, const struct Bytecode* code,
+		      struct Output* out, struct Input* in, uint64_t* counts)
 {
-	if (self->right)
-		free(self->right);
-	if (self->left)
-		free(self->left);
-	self->right = nullptr;
-	self->left  = nullptr;
+	static void* dispatch_table[] = {
+		&&CASE_INC_PTR,		  &&CASE_DEC_PTR,
+		&&CASE_ADD_VAL,		  &&CASE_SUB_VAL,
+		&&CASE_OUTPUT,		  &&CASE_INPUT,
+		&&CASE_JUMP_ZERO,	  &&CASE_JUMP_NONZERO,
+		&&CASE_SET_VAL,		  &&CASE_MUL_ADD,
+		&&CASE_SCAN_RIGHT,	  &&CASE_SCAN_LEFT,
+		&&CASE_WRITE_LITERAL,	  &&CASE_HALT,
+		&&CASE_INC_PTR_WIDE,	  &&CASE_DEC_PTR_WIDE,
+		&&CASE_JUMP_ZERO_WIDE,	  &&CASE_JUMP_NONZERO_WIDE,
+		&&CASE_SCAN_RIGHT_WIDE,	  &&CASE_SCAN_LEFT_WIDE,
+#define SUPER_LABEL(first, second) &&CASE_##first##_##second,
+		SUPERINSTRUCTIONS(SUPER_LABEL)
+#undef SUPER_LABEL
+	};
+	static void* profile_table[] = {
+		[0 ... OpCode_COUNT - 1] = &&CASE_PROFILE};
+
+	void** table = counts ? profile_table : dispatch_table;
+
+	const uint32_t* words = code->words;
+	size_t pc	      = 0;
+
+	uint8_t* curr_ptr = tap_get_ptr(self);
+
+	uint32_t w = words[0];
+
+	goto* table[WORD_OPCODE(w)];
+
+#define DISPATCH()                            \
+	do {                                  \
+		pc++;                         \
+		w = words[pc];                \
+		goto* table[WORD_OPCODE(w)];  \
+	} while (0)
+
+#define JUMP(target)                          \
+	do {                                  \
+		pc = (target);                \
+		w  = words[pc];               \
+		goto* table[WORD_OPCODE(w)];  \
+	} while (0)
+
+CASE_PROFILE:
+	counts[pc]++;
+	goto* dispatch_table[WORD_OPCODE(w)];
+
+/*
+ * The single-word ops, written once so that the plain handlers and the
+ * superinstructions share them.
+ */
+#define OP_INC_PTR(w) curr_ptr += WORD_OPERAND(w)
+#define OP_DEC_PTR(w) curr_ptr -= WORD_OPERAND(w)
+#define OP_ADD_VAL(w) curr_ptr[WORD_OFFSET(w)] += WORD_VALUE(w)
+#define OP_SUB_VAL(w) curr_ptr[WORD_OFFSET(w)] -= WORD_VALUE(w)
+#define OP_OUTPUT(w) output_put(out, curr_ptr[WORD_OFFSET(w)])
+#define OP_INPUT(w)                                            \
+	do {                                                   \
+		int c = input_get(in, out);                    \
+		if (c != EOF)                                  \
+			curr_ptr[WORD_OFFSET(w)] = (uint8_t)c; \
+	} while (0)
+#define OP_JUMP_ZERO(w)                     \
+	do {                                \
+		if (*curr_ptr == 0)         \
+			JUMP(WORD_OPERAND(w)); \
+	} while (0)
+#define OP_JUMP_NONZERO(w)                  \
+	do {                                \
+		if (*curr_ptr != 0)         \
+			JUMP(WORD_OPERAND(w)); \
+	} while (0)
+#define OP_SET_VAL(w) curr_ptr[WORD_OFFSET(w)] = WORD_VALUE(w)
+#define OP_MUL_ADD(w) curr_ptr[WORD_OFFSET(w)] += *curr_ptr * WORD_VALUE(w)
+#define OP_SCAN_RIGHT(w) \
+	curr_ptr = tap_scan_right(self, curr_ptr, WORD_OPERAND(w))
+#define OP_SCAN_LEFT(w) curr_ptr = tap_scan_left(self, curr_ptr, WORD_OPERAND(w))
+
+CASE_INC_PTR:
+	OP_INC_PTR(w);
+	DISPATCH();
+
+CASE_DEC_PTR:
+	OP_DEC_PTR(w);
+	DISPATCH();
+
+CASE_ADD_VAL:
+	OP_ADD_VAL(w);
+	DISPATCH();
+
+CASE_SUB_VAL:
+	OP_SUB_VAL(w);
+	DISPATCH();
+
+CASE_OUTPUT:
+	OP_OUTPUT(w);
+	DISPATCH();
+
+CASE_INPUT:
+	OP_INPUT(w);
+	DISPATCH();
+
+CASE_JUMP_ZERO:
+	OP_JUMP_ZERO(w);
+	DISPATCH();
+
+CASE_JUMP_NONZERO:
+	OP_JUMP_NONZERO(w);
+	DISPATCH();
+
+CASE_SET_VAL:
+	OP_SET_VAL(w);
+	DISPATCH();
+
+CASE_MUL_ADD:
+	OP_MUL_ADD(w);
+	DISPATCH();
+
+CASE_SCAN_RIGHT:
+	OP_SCAN_RIGHT(w);
+	DISPATCH();
+
+CASE_SCAN_LEFT:
+	OP_SCAN_LEFT(w);
+	DISPATCH();
+
+/* The first op runs from w, then the second from the word after it. */
+#define SUPER_CASE(first, second)     \
+	CASE_##first##_##second:      \
+	OP_##first(w);                \
+	pc++;                         \
+	w = words[pc];                \
+	OP_##second(w);               \
+	DISPATCH();
+	SUPERINSTRUCTIONS(SUPER_CASE)
+#undef SUPER_CASE
+
+CASE_WRITE_LITERAL:
+	output_write(out, code->data + bytecode_wide(words + pc + 3),
+		     bytecode_wide(words + pc + 1));
+	pc += 4;
+	DISPATCH();
+
+CASE_INC_PTR_WIDE:
+	curr_ptr += bytecode_wide(words + pc + 1);
+	pc += 2;
+	DISPATCH();
+
+CASE_DEC_PTR_WIDE:
+	curr_ptr -= bytecode_wide(words + pc + 1);
+	pc += 2;
+	DISPATCH();
+
+CASE_JUMP_ZERO_WIDE:
+	if (*curr_ptr == 0)
+		JUMP(bytecode_wide(words + pc + 1));
+	pc += 2;
+	DISPATCH();
+
+CASE_JUMP_NONZERO_WIDE:
+	if (*curr_ptr != 0)
+		JUMP(bytecode_wide(words + pc + 1));
+	pc += 2;
+	DISPATCH();
+
+CASE_SCAN_RIGHT_WIDE:
+	curr_ptr = tap_scan_right(self, curr_ptr, bytecode_wide(words + pc + 1));
+	pc += 2;
+	DISPATCH();
+
+CASE_SCAN_LEFT_WIDE:
+	curr_ptr = tap_scan_left(self, curr_ptr, bytecode_wide(words + pc + 1));
+	pc += 2;
+	DISPATCH();
+
+CASE_HALT:
+	return;
 }
 
-bool tap_move(struct Tap* self, long offset)
+/*
+ * Tape faults past the limit unwind back here through tap_fault; the run
+ * then returns false and tap_report_fault says why.  `counts` is non-null
+ * under --profile and gets one counter per bytecode word.
+ */
+bool tap_run(struct Tap* self, const struct Bytecode* code,
+	     struct Output* out, struct Input* in, uint64_t* counts)
 {
-	self->pos += offset;
+	if (sigsetjmp(self->escape, 1) != 0)
+		return false;
+	tap_exec(self, code, out, in, counts);
+	return true;
+}
 
-	if (self->pos >= 0) {
-		if ((size_t)self->pos >= self->right_cap) {
-			size_t new_cap = self->right_cap * 2;
+#if defined(__x86_64__)
 
-			if (new_cap <= (size_t)self->pos)
-				new_cap = (size_t)self->pos + 1;
+/*
+ * The JIT keeps the head in rbx and a JitState* in r12.  Moves are a bare
+ * add/sub on rbx: running off the tape faults into tap_fault like the
+ * interpreter does.
+ */
+struct JitState {
+	struct Tap* tap;
+	struct Output* out;
+};
 
-			if (new_cap > self->limit) {
-				fprintf(stderr, "Error: Tape limit exceeded "
-						"(Right).\n");
-				return false;
-			}
+struct CodeBuffer {
+	uint8_t* data;
+	size_t size;
+	size_t capacity;
+	bool failed;
+};
 
-			uint8_t* new_mem = realloc(self->right, new_cap);
-			if (!new_mem)
-				return false;
+uint8_t* jit_scan_right(struct JitState* state, uint8_t* ptr, size_t stride)
+{
+	return tap_scan_right(state->tap, ptr, stride);
+}
 
-			memset(new_mem + self->right_cap, 0,
-			       new_cap - self->right_cap);
+uint8_t* jit_scan_left(struct JitState* state, uint8_t* ptr, size_t stride)
+{
+	return tap_scan_left(state->tap, ptr, stride);
+}
 
-			self->right	= new_mem;
-			self->right_cap = new_cap;
-		}
-	} else {
-		size_t index = ~self->pos;
-		if (index >= self->left_cap) {
-			size_t new_cap = self->left_cap * 2;
-			if (new_cap <= index)
-				new_cap = index + 1;
-
-			if (new_cap > self->limit) {
-				fprintf(stderr,
-					"Error: Tape limit exceeded (Left).\n");
-				return false;
-			}
+void jit_output(struct JitState* state, uint8_t c)
+{
+	output_put(state->out, c);
+}
 
-			uint8_t* new_mem = realloc(self->left, new_cap);
-			if (!new_mem)
-				return false;
+void jit_write_literal(struct JitState* state, const uint8_t* data,
+		       size_t size)
+{
+	output_write(state->out, data, size);
+}
 
-			memset(new_mem + self->left_cap, 0,
-			       new_cap - self->left_cap);
+int jit_input(struct JitState* state)
+{
+	output_flush(state->out);
+	return getchar();
+}
 
-			self->left     = new_mem;
-			self->left_cap = new_cap;
+void code_emit(struct CodeBuffer* code, const void* bytes, size_t n)
+{
+	if (code->size + n > code->capacity) {
+		size_t new_cap = code->capacity ? code->capacity * 2 : 4096;
+		while (new_cap < code->size + n)
+			new_cap *= 2;
+		uint8_t* new_data = realloc(code->data, new_cap);
+		if (!new_data) {
+			code->failed = true;
+			return;
 		}
+		code->data     = new_data;
+		code->capacity = new_cap;
 	}
-	return true;
+	memcpy(code->data + code->size, bytes, n);
+	code->size += n;
 }
 
-bool program_init(struct Program* prog)
+static inline void code_byte(struct CodeBuffer* code, uint8_t byte)
 {
-	prog->capacity = 1024;
-	prog->size     = 0;
-	prog->ops      = malloc(sizeof(struct Instruction) * prog->capacity);
-	return prog->ops != nullptr;
+	code_emit(code, &byte, 1);
 }
 
-void program_free(struct Program* prog)
+static inline void code_u32(struct CodeBuffer* code, uint32_t value)
 {
-	if (prog->ops)
-		free(prog->ops);
-	prog->ops      = nullptr;
-	prog->size     = 0;
-	prog->capacity = 0;
+	code_emit(code, &value, sizeof(value));
 }
 
-bool compile_source(const char* source, struct Program* prog)
+static inline void code_u64(struct CodeBuffer* code, uint64_t value)
 {
-	size_t len = strlen(source);
-	size_t loop_stack[4096];
-	int stack_top = -1;
+	code_emit(code, &value, sizeof(value));
+}
 
-	for (size_t i = 0; i < len; ++i) {
-		char c			 = source[i];
-		struct Instruction instr = {0};
-		bool emit_instruction	 = true;
+/* ModRM (+ disp) addressing [rbx + disp] with `reg` in the reg field. */
+void code_rbx_mem(struct CodeBuffer* code, uint8_t reg, long disp)
+{
+	if (disp == 0) {
+		code_byte(code, (uint8_t)(0x03 | reg << 3));
+	} else if (disp >= INT8_MIN && disp <= INT8_MAX) {
+		code_byte(code, (uint8_t)(0x43 | reg << 3));
+		code_byte(code, (uint8_t)(int8_t)disp);
+	} else {
+		code_byte(code, (uint8_t)(0x83 | reg << 3));
+		code_u32(code, (uint32_t)(int32_t)disp);
+	}
+}
 
-		switch (c) {
-		case '>':
-			instr.type    = OperationType_INC_PTR;
-			instr.operand = 1;
-			while (i + 1 < len && source[i + 1] == '>') {
-				instr.operand++;
-				i++;
+/* mov rax, imm64; call rax */
+void code_call(struct CodeBuffer* code, const void* fn)
+{
+	code_emit(code, (uint8_t[]){0x48, 0xB8}, 2);
+	code_u64(code, (uint64_t)(uintptr_t)fn);
+	code_emit(code, (uint8_t[]){0xFF, 0xD0}, 2);
+}
+
+/* mov edx, imm32, widened to mov rdx, imm64 for values past 32 bits. */
+static inline void code_rdx_imm(struct CodeBuffer* code, uint64_t value)
+{
+	if (value <= UINT32_MAX) {
+		code_byte(code, 0xBA);
+		code_u32(code, (uint32_t)value);
+	} else {
+		code_emit(code, (uint8_t[]){0x48, 0xBA}, 2);
+		code_u64(code, value);
+	}
+}
+
+/* mov rbx, rax after a helper returned the new head. */
+static inline void code_take_head(struct CodeBuffer* code)
+{
+	code_emit(code, (uint8_t[]){0x48, 0x89, 0xC3}, 3);
+}
+
+static inline void code_patch_rel32(struct CodeBuffer* code, size_t at,
+				    size_t target)
+{
+	if (code->failed)
+		return;
+	int32_t rel = (int32_t)((long)target - (long)(at + 4));
+	memcpy(code->data + at, &rel, sizeof(rel));
+}
+
+bool jit_compile(struct Program* prog, struct CodeBuffer* code)
+{
+	size_t* loop_stack = malloc(sizeof(size_t) * (prog->size + 1));
+	size_t stack_top   = 0;
+
+	if (!loop_stack)
+		return false;
+
+	/* push rbx; push r12; sub rsp, 8; mov r12, rdi; mov rbx, rsi */
+	code_emit(code,
+		  (uint8_t[]){0x53, 0x41, 0x54, 0x48, 0x83, 0xEC, 0x08, 0x49,
+			      0x89, 0xFC, 0x48, 0x89, 0xF3},
+		  13);
+
+	for (size_t pc = 0; pc < prog->size; ++pc) {
+		struct Instruction instr = prog->ops[pc];
+
+		switch (instr.type) {
+		case OperationType_INC_PTR:
+		case OperationType_DEC_PTR: {
+			bool right = instr.type == OperationType_INC_PTR;
+
+			/* add/sub rbx, imm32, whose immediate is sign-extended */
+			if (instr.operand <= INT32_MAX) {
+				code_emit(code,
+					  (uint8_t[]){0x48, 0x81,
+						      right ? 0xC3 : 0xEB},
+					  3);
+				code_u32(code, (uint32_t)instr.operand);
+				break;
 			}
+
+			/* mov rax, imm64; add/sub rbx, rax */
+			code_emit(code, (uint8_t[]){0x48, 0xB8}, 2);
+			code_u64(code, (uint64_t)instr.operand);
+			code_emit(code,
+				  (uint8_t[]){0x48, right ? 0x01 : 0x29, 0xC3},
+				  3);
 			break;
-		case '<':
-			instr.type    = OperationType_DEC_PTR;
-			instr.operand = 1;
-			while (i + 1 < len && source[i + 1] == '<') {
-				instr.operand++;
-				i++;
-			}
+		}
+
+		case OperationType_ADD_VAL:
+		case OperationType_SUB_VAL: {
+			uint8_t value = (uint8_t)instr.operand;
+			if (instr.type == OperationType_SUB_VAL)
+				value = (uint8_t)-value;
+
+			/* add byte [rbx + offset], imm8 */
+			code_byte(code, 0x80);
+			code_rbx_mem(code, 0, instr.offset);
+			code_byte(code, value);
 			break;
-		case '+':
-			instr.type    = OperationType_ADD_VAL;
-			instr.operand = 1;
-			while (i + 1 < len && source[i + 1] == '+') {
-				instr.operand++;
-				i++;
-			}
+		}
+
+		case OperationType_SET_VAL:
+			/* mov byte [rbx + offset], imm8 */
+			code_byte(code, 0xC6);
+			code_rbx_mem(code, 0, instr.offset);
+			code_byte(code, (uint8_t)instr.operand);
 			break;
-		case '-':
-			instr.type    = OperationType_SUB_VAL;
-			instr.operand = 1;
-			while (i + 1 < len && source[i + 1] == '-') {
-				instr.operand++;
-				i++;
+
+		case OperationType_MUL_ADD: {
+			uint8_t factor = (uint8_t)instr.operand;
+
+			/* movzx eax, byte [rbx] */
+			code_emit(code, (uint8_t[]){0x0F, 0xB6, 0x03}, 3);
+			if (factor != 1 && factor != UINT8_MAX) {
+				/* imul eax, eax, imm32 */
+				code_emit(code, (uint8_t[]){0x69, 0xC0}, 2);
+				code_u32(code, factor);
 			}
+			/* add/sub byte [rbx + offset], al */
+			code_byte(code, factor == UINT8_MAX ? 0x28 : 0x00);
+			code_rbx_mem(code, 0, instr.offset);
 			break;
-		case '.':
-			instr.type = OperationType_OUTPUT;
-			break;
-		case ',':
-			instr.type = OperationType_INPUT;
+		}
+
+		case OperationType_OUTPUT:
+			/* mov rdi, r12; movzx esi, byte [rbx + offset] */
+			code_emit(code, (uint8_t[]){0x4C, 0x89, 0xE7, 0x0F, 0xB6},
+				  5);
+			code_rbx_mem(code, 6, instr.offset);
+			code_call(code, jit_output);
 			break;
-		case '[':
-
-			if (i + 2 < len &&
-			    (source[i + 1] == '-' || source[i + 1] == '+') &&
-			    source[i + 2] == ']') {
-				instr.type = OperationType_SET_ZERO;
-				i += 2;
-			} else {
-				instr.type = OperationType_JUMP_ZERO;
-				stack_top++;
-				if (stack_top >= 4096)
-					return false;
-				loop_stack[stack_top] = prog->size;
-			}
+
+		case OperationType_INPUT: {
+			/* mov rdi, r12; call jit_input */
+			code_emit(code, (uint8_t[]){0x4C, 0x89, 0xE7}, 3);
+			code_call(code, jit_input);
+
+			/* cmp eax, -1; je skip; mov byte [rbx + offset], al */
+			code_emit(code, (uint8_t[]){0x83, 0xF8, 0xFF, 0x74}, 4);
+			size_t skip = code->size;
+			code_byte(code, 0);
+			code_byte(code, 0x88);
+			code_rbx_mem(code, 0, instr.offset);
+			if (!code->failed)
+				code->data[skip] =
+					(uint8_t)(code->size - skip - 1);
 			break;
-		case ']':
-			if (stack_top < 0)
-				return false;
-			size_t open_idx = loop_stack[stack_top];
-			stack_top--;
-			instr.type    = OperationType_JUMP_NONZERO;
-			instr.operand = open_idx;
-			prog->ops[open_idx].operand = prog->size;
+		}
+
+		case OperationType_JUMP_ZERO:
+			/* cmp byte [rbx], 0; je <after loop> */
+			code_emit(code,
+				  (uint8_t[]){0x80, 0x3B, 0x00, 0x0F, 0x84}, 5);
+			loop_stack[stack_top++] = code->size;
+			code_u32(code, 0);
 			break;
-		default:
-			emit_instruction = false;
+
+		case OperationType_JUMP_NONZERO: {
+			size_t open_fixup = loop_stack[--stack_top];
+
+			/* cmp byte [rbx], 0; jne <loop body> */
+			code_emit(code,
+				  (uint8_t[]){0x80, 0x3B, 0x00, 0x0F, 0x85}, 5);
+			size_t close_fixup = code->size;
+			code_u32(code, 0);
+
+			code_patch_rel32(code, close_fixup, open_fixup + 4);
+			code_patch_rel32(code, open_fixup, code->size);
 			break;
 		}
 
-		if (emit_instruction) {
-			if (prog->size >= prog->capacity) {
-				prog->capacity *= 2;
-				struct Instruction* new_ops = realloc(
-					prog->ops, sizeof(struct Instruction) *
-							   prog->capacity);
-				if (!new_ops)
-					return false;
-				prog->ops = new_ops;
-			}
-			prog->ops[prog->size++] = instr;
+		case OperationType_SCAN_RIGHT:
+		case OperationType_SCAN_LEFT:
+			/* mov rdi, r12; mov rsi, rbx; mov rdx, stride */
+			code_emit(code,
+				  (uint8_t[]){0x4C, 0x89, 0xE7, 0x48, 0x89,
+					      0xDE},
+				  6);
+			code_rdx_imm(code, instr.operand);
+			code_call(code, instr.type == OperationType_SCAN_RIGHT
+						? (void*)jit_scan_right
+						: (void*)jit_scan_left);
+			code_take_head(code);
+			break;
+
+		case OperationType_WRITE_LITERAL:
+			/* mov rdi, r12; mov rsi, imm64; mov rdx, length */
+			code_emit(code, (uint8_t[]){0x4C, 0x89, 0xE7, 0x48, 0xBE},
+				  5);
+			code_u64(code, (uint64_t)(uintptr_t)(prog->data +
+							     instr.offset));
+			code_rdx_imm(code, instr.operand);
+			code_call(code, jit_write_literal);
+			break;
+
+		case OperationType_HALT:
+			/* xor eax, eax; add rsp, 8; pop r12; pop rbx; ret */
+			code_emit(code,
+				  (uint8_t[]){0x31, 0xC0, 0x48, 0x83, 0xC4,
+					      0x08, 0x41, 0x5C, 0x5B, 0xC3},
+				  10);
+			break;
 		}
 	}
 
-	if (stack_top >= 0) {
-		fprintf(stderr, "Error: Unmatched '['\n");
+	free(loop_stack);
+	return !code->failed;
+}
+
+bool jit_run(struct Tap* self, struct Program* prog, struct Output* out,
+	     bool verbose)
+{
+	struct CodeBuffer code = {0};
+	if (!jit_compile(prog, &code)) {
+		fprintf(stderr, "Error: JIT compilation failed.\n");
+		free(code.data);
 		return false;
 	}
 
-	if (prog->size >= prog->capacity) {
-		prog->capacity += 1;
-		prog->ops = realloc(prog->ops, sizeof(struct Instruction) *
-						       prog->capacity);
+	if (verbose) {
+		printf("JIT: %zu bytes of machine code\n", code.size);
+		fflush(stdout);
 	}
-	prog->ops[prog->size].type = OperationType_HALT;
-	prog->size++;
 
-	return true;
+	void* mem = mmap(nullptr, code.size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		free(code.data);
+		return false;
+	}
+	memcpy(mem, code.data, code.size);
+	free(code.data);
+
+	if (mprotect(mem, code.size, PROT_READ | PROT_EXEC) != 0) {
+		munmap(mem, code.size);
+		return false;
+	}
+
+	struct JitState state = {.tap = self, .out = out};
+
+	int (*entry)(struct JitState*, uint8_t*) =
+		(int (*)(struct JitState*, uint8_t*))mem;
+
+	bool ok = true;
+	if (sigsetjmp(self->escape, 1) == 0) {
+		entry(&state, tap_get_ptr(self));
+	} else {
+		tap_report_fault(self->fault);
+		ok = false;
+	}
+
+	munmap(mem, code.size);
+	return ok;
 }
 
-void tap_run(struct Tap* self, struct Program* prog)
-{
-	static void* dispatch_table[] = {&&CASE_INC_PTR,   &&CASE_DEC_PTR,
-					 &&CASE_ADD_VAL,   &&CASE_SUB_VAL,
-					 &&CASE_OUTPUT,	   &&CASE_INPUT,
-					 &&CASE_JUMP_ZERO, &&CASE_JUMP_NONZERO,
-					 &&CASE_SET_ZERO,  &&CASE_HALT};
+#endif
 
-	size_t pc = 0;
+/*
+ * --batch: one compiled program over many inputs.  Each worker thread owns
+ * a Tap and an Output and runs inputs start to finish, reading each from
+ * memory and writing its output to a file of its own.  Inputs are dealt out
+ * to the workers in contiguous ranges up front; a worker that runs dry
+ * steals the back half of the fullest-looking range it finds, so one slow
+ * input only ever holds up its own worker.
+ */
+#define BATCH_MAX_THREADS 256
 
-	uint8_t* curr_ptr = tap_get_ptr(self);
+struct BatchWorker {
+	struct Batch* batch;
+	size_t id;
+	pthread_t thread;
 
-	struct Instruction instr = prog->ops[0];
+	/* Inputs [head, tail) are still queued on this worker. */
+	pthread_mutex_t lock;
+	size_t head;
+	size_t tail;
 
-	goto* dispatch_table[instr.type];
+	struct Tap tap;
+	struct Output* out;
+	size_t failed;
+};
 
-#define DISPATCH()                                \
-	do {                                      \
-		pc++;                             \
-		instr = prog->ops[pc];            \
-		goto* dispatch_table[instr.type]; \
-	} while (0)
+struct Batch {
+	const struct Bytecode* code;
+	size_t tape_size;
+	size_t limit;
+	size_t margin;
 
-CASE_INC_PTR:
-	if (!tap_move(self, (long)instr.operand))
-		return;
-	curr_ptr = tap_get_ptr(self);
-	DISPATCH();
+	char** inputs;
+	size_t input_count;
+	const char* out_dir;
 
-CASE_DEC_PTR:
-	if (!tap_move(self, -(long)instr.operand))
-		return;
-	curr_ptr = tap_get_ptr(self);
-	DISPATCH();
+	struct BatchWorker* workers;
+	size_t worker_count;
+};
 
-CASE_ADD_VAL:
-	*curr_ptr += (uint8_t)instr.operand;
-	DISPATCH();
+static int batch_compare(const void* a, const void* b)
+{
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
 
-CASE_SUB_VAL:
-	*curr_ptr -= (uint8_t)instr.operand;
-	DISPATCH();
+static bool batch_is_output(const char* name)
+{
+	size_t len = strlen(name);
+	return len >= 4 && strcmp(name + len - 4, ".out") == 0;
+}
 
-CASE_OUTPUT:
-	putchar(*curr_ptr);
-	DISPATCH();
+bool batch_add(struct Batch* self, size_t* capacity, char* path)
+{
+	if (!path)
+		return false;
+	if (self->input_count == *capacity) {
+		size_t new_cap = *capacity ? *capacity * 2 : 256;
+		char** grown   = realloc(self->inputs, sizeof(char*) * new_cap);
+		if (!grown) {
+			free(path);
+			return false;
+		}
+		self->inputs = grown;
+		*capacity    = new_cap;
+	}
+	self->inputs[self->input_count++] = path;
+	return true;
+}
 
-CASE_INPUT: {
-	int c = getchar();
-	if (c != EOF)
-		*curr_ptr = (uint8_t)c;
-	DISPATCH();
+/*
+ * `spec` is either a directory, whose regular files are the inputs (minus
+ * the *.out files a previous batch left there), or a file listing one
+ * input path per line.
+ */
+bool batch_collect(struct Batch* self, const char* spec)
+{
+	size_t capacity = 0;
+
+	DIR* dir = opendir(spec);
+	if (dir) {
+		bool ok = true;
+		struct dirent* entry;
+		while (ok && (entry = readdir(dir))) {
+			if (entry->d_name[0] == '.' ||
+			    batch_is_output(entry->d_name))
+				continue;
+
+			char path[PATH_MAX];
+			int n = snprintf(path, sizeof(path), "%s/%s", spec,
+					 entry->d_name);
+			struct stat st;
+			if (n < 0 || (size_t)n >= sizeof(path) ||
+			    stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+				continue;
+			ok = batch_add(self, &capacity, strdup(path));
+		}
+		closedir(dir);
+		if (!ok)
+			return false;
+		qsort(self->inputs, self->input_count, sizeof(char*),
+		      batch_compare);
+		return true;
+	}
+
+	struct Source list;
+	if (!source_load(&list, spec))
+		return false;
+
+	bool ok = true;
+	for (size_t i = 0; ok && i < list.size;) {
+		size_t end = i;
+		while (end < list.size && list.data[end] != '\n')
+			end++;
+		size_t len = end - i;
+		if (len > 0 && list.data[end - 1] == '\r')
+			len--;
+		if (len > 0)
+			ok = batch_add(self, &capacity,
+				       strndup(list.data + i, len));
+		i = end + 1;
+	}
+	source_free(&list);
+	return ok;
 }
 
-CASE_JUMP_ZERO:
-	if (*curr_ptr == 0) {
-		pc = instr.operand;
+void batch_free(struct Batch* self)
+{
+	for (size_t k = 0; k < self->input_count; ++k)
+		free(self->inputs[k]);
+	free(self->inputs);
+	self->inputs	  = nullptr;
+	self->input_count = 0;
+}
 
-		instr = prog->ops[pc];
-		goto* dispatch_table[instr.type];
+/* "<input>.out", or the input's file name under --out-dir. */
+bool batch_output_path(const struct Batch* self, const char* input,
+		       char* path, size_t size)
+{
+	int n;
+	if (self->out_dir) {
+		const char* name = strrchr(input, '/');
+		n = snprintf(path, size, "%s/%s.out", self->out_dir,
+			     name ? name + 1 : input);
+	} else {
+		n = snprintf(path, size, "%s.out", input);
 	}
-	DISPATCH();
+	return n > 0 && (size_t)n < size;
+}
 
-CASE_JUMP_NONZERO:
-	if (*curr_ptr != 0) {
-		pc    = instr.operand;
-		instr = prog->ops[pc];
-		goto* dispatch_table[instr.type];
+/* Errors name the input; stderr is locked so workers' lines don't mix. */
+static void batch_report(const char* input, const char* what,
+			 struct Tap* tap)
+{
+	flockfile(stderr);
+	fprintf(stderr, "%s: ", input);
+	if (tap)
+		tap_report_fault(tap->fault);
+	else
+		fprintf(stderr, "Error: %s: %s\n", what, strerror(errno));
+	funlockfile(stderr);
+}
+
+bool batch_run_one(struct BatchWorker* self, const char* input)
+{
+	struct Batch* batch = self->batch;
+
+	struct Source source;
+	if (!source_load(&source, input)) {
+		batch_report(input, "Failed to read input", nullptr);
+		return false;
 	}
-	DISPATCH();
 
-CASE_SET_ZERO:
-	*curr_ptr = 0;
-	DISPATCH();
+	char path[PATH_MAX];
+	int fd = -1;
+	if (batch_output_path(batch, input, path, sizeof(path)))
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		batch_report(input, "Failed to open output", nullptr);
+		source_free(&source);
+		return false;
+	}
 
-CASE_HALT:
-	return;
+	self->out->fd	= fd;
+	self->out->size = 0;
+	struct Input in = {.data = (const uint8_t*)source.data,
+			   .size = source.size};
+
+	tap_reset(&self->tap);
+	bool ok = tap_run(&self->tap, batch->code, self->out, &in, nullptr);
+	if (!ok)
+		batch_report(input, nullptr, &self->tap);
+
+	ok = output_flush(self->out) && ok;
+	ok = close(fd) == 0 && ok;
+	source_free(&source);
+	return ok;
 }
 
-char* read_file(const char* filename)
+/* Takes the next queued input, stealing from another worker when empty. */
+bool batch_next(struct BatchWorker* self, size_t* input)
 {
-	FILE* f = fopen(filename, "rb");
-	if (!f)
+	pthread_mutex_lock(&self->lock);
+	bool found = self->head < self->tail;
+	if (found)
+		*input = self->head++;
+	pthread_mutex_unlock(&self->lock);
+	if (found)
+		return true;
+
+	struct Batch* batch = self->batch;
+	for (size_t k = 1; k < batch->worker_count; ++k) {
+		struct BatchWorker* victim =
+			&batch->workers[(self->id + k) % batch->worker_count];
+
+		pthread_mutex_lock(&victim->lock);
+		size_t left = victim->tail - victim->head;
+		size_t take = (left + 1) / 2;
+		victim->tail -= take;
+		size_t from = victim->tail;
+		pthread_mutex_unlock(&victim->lock);
+
+		if (take == 0)
+			continue;
+
+		pthread_mutex_lock(&self->lock);
+		self->head = from + 1;
+		self->tail = from + take;
+		pthread_mutex_unlock(&self->lock);
+		*input = from;
+		return true;
+	}
+	return false;
+}
+
+void* batch_worker(void* arg)
+{
+	struct BatchWorker* self = arg;
+	struct Batch* batch	 = self->batch;
+
+	if (!tap_init(&self->tap, batch->tape_size, batch->limit,
+		      batch->margin)) {
+		fprintf(stderr, "Failed to initialize tap.\n");
+		self->failed = SIZE_MAX;
 		return nullptr;
-	fseek(f, 0, SEEK_END);
-	long length = ftell(f);
-	fseek(f, 0, SEEK_SET);
-	char* buffer = malloc(length + 1);
-	if (buffer) {
-		fread(buffer, 1, length, f);
-		buffer[length] = '\0';
 	}
-	fclose(f);
-	return buffer;
+
+	size_t input;
+	while (batch_next(self, &input)) {
+		if (!batch_run_one(self, batch->inputs[input]))
+			self->failed++;
+	}
+
+	tap_deinit(&self->tap);
+	return nullptr;
+}
+
+/* Returns how many inputs failed, or SIZE_MAX if the batch never ran. */
+size_t batch_run(struct Batch* self, size_t threads)
+{
+	if (threads > self->input_count)
+		threads = self->input_count;
+	if (threads > BATCH_MAX_THREADS)
+		threads = BATCH_MAX_THREADS;
+	if (threads == 0)
+		return 0;
+
+	self->workers = calloc(threads, sizeof(struct BatchWorker));
+	if (!self->workers)
+		return SIZE_MAX;
+	self->worker_count = threads;
+
+	size_t failed = 0;
+	size_t ready  = 0;
+	for (; ready < threads; ++ready) {
+		struct BatchWorker* worker = &self->workers[ready];
+		worker->batch		   = self;
+		worker->id		   = ready;
+		worker->head = self->input_count * ready / threads;
+		worker->tail = self->input_count * (ready + 1) / threads;
+		worker->out  = calloc(1, sizeof(struct Output));
+		if (!worker->out ||
+		    pthread_mutex_init(&worker->lock, nullptr) != 0) {
+			free(worker->out);
+			failed = SIZE_MAX;
+			break;
+		}
+	}
+
+	/* Worker 0 runs on this thread. */
+	size_t started = 1;
+	if (failed == 0) {
+		for (; started < threads; ++started) {
+			struct BatchWorker* worker = &self->workers[started];
+			if (pthread_create(&worker->thread, nullptr,
+					   batch_worker, worker) != 0)
+				break;
+		}
+		batch_worker(&self->workers[0]);
+		/* The queues of workers that failed to start get stolen. */
+		for (size_t k = 1; k < started; ++k)
+			pthread_join(self->workers[k].thread, nullptr);
+	}
+
+	for (size_t k = 0; k < ready; ++k) {
+		struct BatchWorker* worker = &self->workers[k];
+		if (failed != SIZE_MAX)
+			failed = worker->failed == SIZE_MAX
+					 ? SIZE_MAX
+					 : failed + worker->failed;
+		pthread_mutex_destroy(&worker->lock);
+		free(worker->out);
+	}
+	free(self->workers);
+	self->workers	   = nullptr;
+	self->worker_count = 0;
+	return failed;
 }
 
 struct Config {
 	size_t tape_size;
 	bool verbose;
+	bool line_buffered;
 	const char* filename;
 	size_t max_cells_limit;
+	const char* cache_dir;
+	bool profile;
+	bool jit;
+	const char* batch;
+	const char* out_dir;
+	size_t threads;
 };
 
 void print_usage(const char* prog_name)
@@ -370,10 +1103,88 @@ void print_usage(const char* prog_name)
 	printf("Usage: %s [options] <file>\n", prog_name);
 	printf("  -h, --help           Show help\n");
 	printf("  -v, --verbose        Verbose output\n");
+	printf("  -l, --line-buffered  Flush program output at every "
+	       "newline\n");
 	printf("  -s, --size <cells>   Initial tape size (1024 cells "
 	       "default)\n");
 	printf("  -m, --max <cells>    Set max tape length limit (30000 cells "
 	       "default)\n");
+	printf("  -c, --cache <dir>    Reuse compiled bytecode cached in "
+	       "<dir>\n");
+	printf("  -p, --profile        Count every op and loop and report the "
+	       "hottest\n");
+	printf("  -j, --jit            Compile to native x86-64 code and run "
+	       "it\n");
+	printf("  -b, --batch <in>     Run every file in directory <in>, or "
+	       "listed in file\n"
+	       "                       <in>, as input; output goes to "
+	       "<input>.out\n");
+	printf("  -o, --out-dir <dir>  Write --batch outputs to <dir> "
+	       "instead\n");
+	printf("  -t, --threads <n>    --batch worker threads (one per CPU "
+	       "default)\n");
+}
+
+/*
+ * Runs the whole front end, from source to runnable bytecode.  Prints what
+ * went wrong and returns false on failure.
+ */
+bool build_bytecode(const struct Source* source, const struct Config* config,
+		    struct Program* program, struct Bytecode* code)
+{
+	if (config->verbose)
+		printf("Compiling...\n");
+
+	/*
+	 * --profile points back into the source, so it lexes the text as
+	 * is; everything else lexes the commands alone.
+	 */
+	const char* text = source->data;
+	size_t size	 = source->size;
+	char* commands	 = nullptr;
+	if (!config->profile) {
+		commands = malloc(source->size + STRIP_SLACK);
+		if (!commands) {
+			fprintf(stderr, "Failed to init program memory.\n");
+			return false;
+		}
+		size = strip_comments(source->data, source->size, commands);
+		text = commands;
+	}
+	enum BfStatus status = compile_source(text, size, program);
+	free(commands);
+	if (status != BfStatus_OK)
+		fprintf(stderr, "Error: %s\n", bf_status_message(status));
+
+	if (status != BfStatus_OK ||
+	    !fold_constant_prefix(program, config->max_cells_limit)) {
+		fprintf(stderr, "Compilation Failed.\n");
+		return false;
+	}
+
+	if (config->verbose)
+		printf("Compilation success. Ops count: %zu\n", program->size);
+
+	if (!bytecode_compile(program, code)) {
+		fprintf(stderr, "Compilation Failed.\n");
+		return false;
+	}
+
+	if (config->verbose)
+		printf("Bytecode: %zu bytes, %.1f ops per 64-byte cache line "
+		       "(%.1f unpacked)\n",
+		       code->size * sizeof(uint32_t),
+		       64.0 * (double)program->size /
+			       (double)(code->size * sizeof(uint32_t)),
+		       64.0 / (double)sizeof(struct Instruction));
+
+	/* Profiles count every op, so they run the pairs apart. */
+	if (!config->profile) {
+		size_t fused = bytecode_fuse(program, code);
+		if (config->verbose)
+			printf("Superinstructions: %zu pairs fused\n", fused);
+	}
+	return true;
 }
 
 int main(int argc, char* argv[])
@@ -381,17 +1192,26 @@ int main(int argc, char* argv[])
 	struct Config config = {.tape_size	 = 1024,
 				.verbose	 = false,
 				.filename	 = nullptr,
-				.max_cells_limit = 30000};
+				.max_cells_limit = 30000,
+				.line_buffered	 = false,
+				.jit		 = false};
 
 	static const struct option long_options[] = {
 		{"help", no_argument, 0, 'h'},
 		{"verbose", no_argument, 0, 'v'},
+		{"line-buffered", no_argument, 0, 'l'},
 		{"size", required_argument, 0, 's'},
 		{"max", required_argument, 0, 'm'},
+		{"cache", required_argument, 0, 'c'},
+		{"profile", no_argument, 0, 'p'},
+		{"jit", no_argument, 0, 'j'},
+		{"batch", required_argument, 0, 'b'},
+		{"out-dir", required_argument, 0, 'o'},
+		{"threads", required_argument, 0, 't'},
 		{0}};
 
 	int opt;
-	while ((opt = getopt_long(argc, argv, "hvs:m:", long_options,
+	while ((opt = getopt_long(argc, argv, "hvlps:m:c:jb:o:t:", long_options,
 				  nullptr)) != -1) {
 		switch (opt) {
 		case 'h':
@@ -400,6 +1220,12 @@ int main(int argc, char* argv[])
 		case 'v':
 			config.verbose = true;
 			break;
+		case 'l':
+			config.line_buffered = true;
+			break;
+		case 'p':
+			config.profile = true;
+			break;
 		case 's': {
 			char* endptr;
 			unsigned long long size = strtoull(optarg, &endptr, 10);
@@ -417,11 +1243,48 @@ int main(int argc, char* argv[])
 			config.max_cells_limit = (size_t)limit;
 			break;
 		}
+		case 'c':
+			config.cache_dir = optarg;
+			break;
+		case 'b':
+			config.batch = optarg;
+			break;
+		case 'o':
+			config.out_dir = optarg;
+			break;
+		case 't': {
+			char* endptr;
+			unsigned long long threads =
+				strtoull(optarg, &endptr, 10);
+			if (*endptr != '\0' || threads == 0)
+				return EXIT_FAILURE;
+			config.threads = (size_t)threads;
+			break;
+		}
+		case 'j':
+#if defined(__x86_64__)
+			config.jit = true;
+			break;
+#else
+			fprintf(stderr, "Error: --jit needs an x86-64 host.\n");
+			return EXIT_FAILURE;
+#endif
 		default:
 			return EXIT_FAILURE;
 		}
 	}
 
+	if (config.profile && config.jit) {
+		fprintf(stderr, "Error: --profile does not work with --jit.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (config.batch && (config.profile || config.jit)) {
+		fprintf(stderr, "Error: --batch does not work with --profile "
+				"or --jit.\n");
+		return EXIT_FAILURE;
+	}
+
 	if (optind < argc) {
 		config.filename = argv[optind];
 	} else {
@@ -430,46 +1293,142 @@ int main(int argc, char* argv[])
 		return EXIT_FAILURE;
 	}
 
-	char* source_code = read_file(config.filename);
-	if (!source_code) {
+	struct Source source;
+	if (!source_load(&source, config.filename)) {
 		perror("Failed to read file");
 		return EXIT_FAILURE;
 	}
 
-	if (config.verbose)
-		printf("Compiling...\n");
-
 	struct Program program;
 	if (!program_init(&program)) {
 		fprintf(stderr, "Failed to init program memory.\n");
-		free(source_code);
+		source_free(&source);
 		return EXIT_FAILURE;
 	}
 
-	if (!compile_source(source_code, &program)) {
-		fprintf(stderr, "Compilation Failed.\n");
-		free(source_code);
-		program_free(&program);
-		return EXIT_FAILURE;
+	/* --profile and --jit need the Program; a cache hit never builds it. */
+	char cache_file[PATH_MAX];
+	uint64_t key = cache_key(CACHE_FORMAT, source.data, source.size,
+				 config.max_cells_limit);
+	bool use_cache = config.cache_dir && !config.profile && !config.jit &&
+			 cache_path(cache_file, sizeof(cache_file),
+				    config.cache_dir, key);
+
+	struct Bytecode code;
+	const struct CacheHeader* cached =
+		use_cache ? cache_load(cache_file, key, source.size,
+				     true, &code)
+			  : nullptr;
+
+	size_t margin;
+	if (cached) {
+		margin = cached->margin;
+		if (config.verbose)
+			printf("Loaded %llu ops from %s\n",
+			       (unsigned long long)cached->ops, cache_file);
+	} else {
+		if (!build_bytecode(&source, &config, &program, &code)) {
+			source_free(&source);
+			program_free(&program);
+			return EXIT_FAILURE;
+		}
+		margin = program.reach + program.travel;
+
+		if (use_cache) {
+			/* The cache directory itself is created on demand. */
+			mkdir(config.cache_dir, 0777);
+			bool stored = cache_store(cache_file, key, source.size,
+						  &program, &code);
+			if (config.verbose)
+				printf("%s %s\n",
+				       stored ? "Cached bytecode in"
+					      : "Failed to cache bytecode in",
+				       cache_file);
+		}
 	}
 
-	free(source_code);
+	if (config.batch) {
+		struct Batch batch = {.code	 = &code,
+				      .tape_size = config.tape_size,
+				      .limit	 = config.max_cells_limit,
+				      .margin	 = margin,
+				      .out_dir	 = config.out_dir};
+
+		size_t failed = SIZE_MAX;
+		if (!batch_collect(&batch, config.batch)) {
+			perror("Failed to list batch inputs");
+		} else {
+			long cpus      = sysconf(_SC_NPROCESSORS_ONLN);
+			size_t threads = config.threads ? config.threads
+					 : cpus > 0	? (size_t)cpus
+							: 1;
+			failed	       = batch_run(&batch, threads);
+			if (config.verbose && failed != SIZE_MAX)
+				printf("Batch: %zu inputs, %zu failed\n",
+				       batch.input_count, failed);
+		}
 
-	if (config.verbose)
-		printf("Compilation success. Ops count: %zu\n", program.size);
+		batch_free(&batch);
+		source_free(&source);
+		bytecode_free(&code);
+		program_free(&program);
+		return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	static struct Output output = {.fd = STDOUT_FILENO};
+	output.line_buffered	     = config.line_buffered;
+
+	uint64_t* counts = nullptr;
+	if (config.profile) {
+		counts = calloc(code.size, sizeof(uint64_t));
+		if (!counts) {
+			fprintf(stderr, "Failed to allocate profile counters.\n");
+			source_free(&source);
+			bytecode_free(&code);
+			program_free(&program);
+			return EXIT_FAILURE;
+		}
+	}
 
 	struct Tap tap;
-	if (!tap_init(&tap, config.tape_size, config.max_cells_limit)) {
+	if (!tap_init(&tap, config.tape_size, config.max_cells_limit,
+		      margin)) {
 		fprintf(stderr, "Failed to initialize tap.\n");
+		free(counts);
+		source_free(&source);
+		bytecode_free(&code);
 		program_free(&program);
 		return EXIT_FAILURE;
 	}
 
 	if (config.verbose)
 		printf("Running...\n");
-	tap_run(&tap, &program);
+	fflush(stdout);
+
+	struct Input input = {0};
+#if defined(__x86_64__)
+	if (config.jit)
+		jit_run(&tap, &program, &output, config.verbose);
+	else if (!tap_run(&tap, &code, &output, &input, counts))
+		tap_report_fault(tap.fault);
+#else
+	if (!tap_run(&tap, &code, &output, &input, counts))
+		tap_report_fault(tap.fault);
+#endif
+	output_flush(&output);
+
+	if (counts) {
+		/* Per word to per op, in place: word_at[k] >= k. */
+		for (size_t k = 0; k < program.size; ++k)
+			counts[k] = counts[code.word_at[k]];
+		profile_report(&program, counts, source.data, source.size,
+			       stderr);
+	}
 
+	free(counts);
+	source_free(&source);
 	tap_deinit(&tap);
+	bytecode_free(&code);
 	program_free(&program);
 	return EXIT_SUCCESS;
 }
\ No newline at end of file
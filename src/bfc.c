@@ -0,0 +1,902 @@
+#define _GNU_SOURCE
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <spawn.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "frontend.h"
+#include "source.h"
+
+#ifndef BFC_CC
+#define BFC_CC "cc"
+#endif
+
+extern char** environ;
+
+static void emit_line(FILE* out, int depth, const char* fmt, ...)
+{
+	for (int k = 0; k < depth; ++k)
+		fputc('\t', out);
+
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(out, fmt, args);
+	va_end(args);
+	fputc('\n', out);
+}
+
+/*
+ * Legal cells run from `tape_left(limit)` left of the start to `limit - 1`
+ * right of it.  The interpreters round their left end out to a page, so
+ * compiled programs stop at the very same cell they do.
+ */
+static size_t tape_left(size_t limit)
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	return (2 * limit + page - 1) / page * page - limit;
+}
+
+/*
+ * Bounds checking.  A pending move is only ever flushed right before an op
+ * that reads the cell under the head, so checking each move keeps the head
+ * itself on the tape and the cells it lands on need no further check.  The
+ * other offsets are checked a run of ops at a time: access_run returns
+ * where the run starting at `pc` ends and the lowest and highest offset it
+ * touches.  A run stops at the first move, jump or scan, and right after
+ * any I/O, so no output escapes before a check that would have stopped the
+ * interpreters first.
+ */
+static size_t access_run(const struct Program* prog, size_t pc, long* min,
+			 long* max)
+{
+	*min = 0;
+	*max = 0;
+	for (; pc < prog->size; ++pc) {
+		const struct Instruction* instr = &prog->ops[pc];
+		switch (instr->type) {
+		case OperationType_ADD_VAL:
+		case OperationType_SUB_VAL:
+		case OperationType_SET_VAL:
+		case OperationType_MUL_ADD:
+		case OperationType_OUTPUT:
+		case OperationType_INPUT:
+			break;
+		default:
+			return pc;
+		}
+
+		if (instr->offset < *min)
+			*min = instr->offset;
+		if (instr->offset > *max)
+			*max = instr->offset;
+		if (instr->type == OperationType_OUTPUT ||
+		    instr->type == OperationType_INPUT)
+			return pc + 1;
+	}
+	return pc;
+}
+
+static void emit_move(FILE* out, int depth, char sign, size_t amount)
+{
+	emit_line(out, depth, "p %c= %zu;", sign, amount);
+	emit_line(out, depth, "if (p %c %s)", sign == '+' ? '>' : '<',
+		  sign == '+' ? "hi" : "lo");
+	emit_line(out, depth + 1, "tape_overflow(\"%s\");",
+		  sign == '+' ? "Right" : "Left");
+}
+
+static void emit_run_check(FILE* out, int depth, long min, long max)
+{
+	if (min < 0) {
+		emit_line(out, depth, "if (p - %ld < lo)", -min);
+		emit_line(out, depth + 1, "tape_overflow(\"Left\");");
+	}
+	if (max > 0) {
+		emit_line(out, depth, "if (p + %ld > hi)", max);
+		emit_line(out, depth + 1, "tape_overflow(\"Right\");");
+	}
+}
+
+/*
+ * Translates the optimized Program into one C translation unit: a fixed tape
+ * sized from the cell limit plus the program's reach, the head as a local
+ * pointer and loops as while statements.
+ */
+bool emit_c(struct Program* prog, size_t limit, FILE* out)
+{
+	emit_line(out, 0, "#define _GNU_SOURCE");
+	emit_line(out, 0, "#include <stdint.h>");
+	emit_line(out, 0, "#include <stdio.h>");
+	emit_line(out, 0, "#include <stdlib.h>");
+	emit_line(out, 0, "#include <string.h>\n");
+	emit_line(out, 0, "#define TAPE_LIMIT %zu", limit);
+	emit_line(out, 0, "#define TAPE_LEFT %zu", tape_left(limit));
+	emit_line(out, 0, "#define TAPE_REACH %zu\n", prog->reach);
+	emit_line(out, 0, "static uint8_t tape[TAPE_LEFT + TAPE_LIMIT + "
+			  "2 * TAPE_REACH];\n");
+	emit_line(out, 0, "static void tape_overflow(const char* side)");
+	emit_line(out, 0, "{");
+	emit_line(out, 1, "fprintf(stderr, \"Error: Tape limit exceeded "
+			  "(%%s).\\n\", side);");
+	emit_line(out, 1, "exit(EXIT_FAILURE);");
+	emit_line(out, 0, "}\n");
+	emit_line(out, 0, "int main(void)");
+	emit_line(out, 0, "{");
+	emit_line(out, 1, "uint8_t* const lo = tape + TAPE_REACH;");
+	emit_line(out, 1,
+		  "uint8_t* const hi = lo + TAPE_LEFT + TAPE_LIMIT - 1;");
+	emit_line(out, 1, "uint8_t* p = lo + TAPE_LEFT;\n");
+
+	int depth      = 1;
+	size_t run_end = 0;
+	for (size_t pc = 0; pc < prog->size; ++pc) {
+		struct Instruction instr = prog->ops[pc];
+		unsigned value		 = (uint8_t)instr.operand;
+		long off		 = instr.offset;
+
+		if (pc >= run_end) {
+			long min, max;
+			run_end = access_run(prog, pc, &min, &max);
+			emit_run_check(out, depth, min, max);
+		}
+
+		switch (instr.type) {
+		case OperationType_INC_PTR:
+			emit_move(out, depth, '+', instr.operand);
+			break;
+		case OperationType_DEC_PTR:
+			emit_move(out, depth, '-', instr.operand);
+			break;
+		case OperationType_ADD_VAL:
+			emit_line(out, depth, "p[%ld] += %u;", off, value);
+			break;
+		case OperationType_SUB_VAL:
+			emit_line(out, depth, "p[%ld] -= %u;", off, value);
+			break;
+		case OperationType_SET_VAL:
+			emit_line(out, depth, "p[%ld] = %u;", off, value);
+			break;
+		case OperationType_MUL_ADD:
+			emit_line(out, depth, "p[%ld] += (uint8_t)(p[0] * %u);",
+				  off, value);
+			break;
+		case OperationType_OUTPUT:
+			emit_line(out, depth, "putchar(p[%ld]);", off);
+			break;
+		case OperationType_INPUT:
+			emit_line(out, depth, "{");
+			emit_line(out, depth + 1, "int c = getchar();");
+			emit_line(out, depth + 1, "if (c != EOF)");
+			emit_line(out, depth + 2, "p[%ld] = (uint8_t)c;", off);
+			emit_line(out, depth, "}");
+			break;
+		case OperationType_JUMP_ZERO:
+			emit_line(out, depth++, "while (*p) {");
+			break;
+		case OperationType_JUMP_NONZERO:
+			emit_line(out, --depth, "}");
+			break;
+		case OperationType_SCAN_RIGHT:
+			if (instr.operand == 1) {
+				emit_line(out, depth,
+					  "p = memchr(p, 0, (size_t)(hi - p) + 1);");
+				emit_line(out, depth, "if (!p)");
+				emit_line(out, depth + 1,
+					  "tape_overflow(\"Right\");");
+			} else {
+				emit_line(out, depth, "while (*p) {");
+				emit_move(out, depth + 1, '+', instr.operand);
+				emit_line(out, depth, "}");
+			}
+			break;
+		case OperationType_SCAN_LEFT:
+			if (instr.operand == 1) {
+				emit_line(out, depth,
+					  "p = memrchr(lo, 0, (size_t)(p - lo) + 1);");
+				emit_line(out, depth, "if (!p)");
+				emit_line(out, depth + 1,
+					  "tape_overflow(\"Left\");");
+			} else {
+				emit_line(out, depth, "while (*p) {");
+				emit_move(out, depth + 1, '-', instr.operand);
+				emit_line(out, depth, "}");
+			}
+			break;
+		/* Only fold_constant_prefix writes literals; bfc never folds. */
+		case OperationType_WRITE_LITERAL:
+		case OperationType_HALT:
+			break;
+		}
+	}
+
+	emit_line(out, 1, "return 0;");
+	emit_line(out, 0, "}");
+	return !ferror(out);
+}
+
+struct CodeBuffer {
+	uint8_t* data;
+	size_t size;
+	size_t capacity;
+	bool failed;
+};
+
+void code_emit(struct CodeBuffer* code, const void* bytes, size_t n)
+{
+	if (code->size + n > code->capacity) {
+		size_t new_cap = code->capacity ? code->capacity * 2 : 4096;
+		while (new_cap < code->size + n)
+			new_cap *= 2;
+		uint8_t* new_data = realloc(code->data, new_cap);
+		if (!new_data) {
+			code->failed = true;
+			return;
+		}
+		code->data     = new_data;
+		code->capacity = new_cap;
+	}
+	memcpy(code->data + code->size, bytes, n);
+	code->size += n;
+}
+
+static inline void code_byte(struct CodeBuffer* code, uint8_t byte)
+{
+	code_emit(code, &byte, 1);
+}
+
+static inline void code_u32(struct CodeBuffer* code, uint32_t value)
+{
+	code_emit(code, &value, sizeof(value));
+}
+
+static inline void code_u64(struct CodeBuffer* code, uint64_t value)
+{
+	code_emit(code, &value, sizeof(value));
+}
+
+/* ModRM (+ disp) addressing [rbx + disp] with `reg` in the reg field. */
+void code_rbx_mem(struct CodeBuffer* code, uint8_t reg, long disp)
+{
+	if (disp == 0) {
+		code_byte(code, (uint8_t)(0x03 | reg << 3));
+	} else if (disp >= INT8_MIN && disp <= INT8_MAX) {
+		code_byte(code, (uint8_t)(0x43 | reg << 3));
+		code_byte(code, (uint8_t)(int8_t)disp);
+	} else {
+		code_byte(code, (uint8_t)(0x83 | reg << 3));
+		code_u32(code, (uint32_t)(int32_t)disp);
+	}
+}
+
+static inline void code_patch_rel32(struct CodeBuffer* code, size_t at,
+				    size_t target)
+{
+	if (code->failed)
+		return;
+	int32_t rel = (int32_t)((long)target - (long)(at + 4));
+	memcpy(code->data + at, &rel, sizeof(rel));
+}
+
+static inline void code_patch_rel8(struct CodeBuffer* code, size_t at,
+				   size_t target)
+{
+	if (code->failed)
+		return;
+	code->data[at] = (uint8_t)(int8_t)((long)target - (long)(at + 1));
+}
+
+/* jcc/jmp/call rel32 to a label that is resolved later. */
+void code_fixup(struct CodeBuffer* code, const uint8_t* op, size_t op_len,
+		size_t* fixups, size_t* count)
+{
+	code_emit(code, op, op_len);
+	fixups[(*count)++] = code->size;
+	code_u32(code, 0);
+}
+
+#define ELF_TEXT_VADDR 0x400000UL
+#define ELF_BSS_VADDR 0x10000000UL
+#define ELF_OUT_BUF_SIZE 4096UL
+#define ELF_HEADERS_SIZE (sizeof(Elf64_Ehdr) + 2 * sizeof(Elf64_Phdr))
+
+static const char elf_left_msg[]  = "Error: Tape limit exceeded (Left).\n";
+static const char elf_right_msg[] = "Error: Tape limit exceeded (Right).\n";
+
+/* Cells from the start of the .bss segment to the output buffer. */
+static size_t elf_tape_size(const struct Program* prog, size_t limit)
+{
+	return tape_left(limit) + limit + 2 * prog->reach;
+}
+
+/*
+ * A tape limit stop: call flush; write(2, msg, len); exit(1).  The jumps
+ * in `fixups` land here; returns where the message address goes.
+ */
+static size_t elf_overflow(struct CodeBuffer* code, const size_t* fixups,
+			   size_t count, size_t* flush_fixups,
+			   size_t* flush_count, size_t msg_len)
+{
+	for (size_t k = 0; k < count; ++k)
+		code_patch_rel32(code, fixups[k], code->size);
+	code_fixup(code, (uint8_t[]){0xE8}, 1, flush_fixups, flush_count);
+	code_emit(code,
+		  (uint8_t[]){0xB8, 0x01, 0x00, 0x00, 0x00, 0xBF, 0x02, 0x00,
+			      0x00, 0x00, 0x48, 0xBE},
+		  12);
+	size_t msg_fixup = code->size;
+	code_u64(code, 0);
+	code_byte(code, 0xBA);
+	code_u32(code, (uint32_t)msg_len);
+	code_emit(code,
+		  (uint8_t[]){0x0F, 0x05, 0xB8, 0x3C, 0x00, 0x00, 0x00, 0xBF,
+			      0x01, 0x00, 0x00, 0x00, 0x0F, 0x05},
+		  14);
+	return msg_fixup;
+}
+
+/* lea rax, [rbx + offset]; cmp rax, r12/r13; jb/ja overflow */
+static void elf_run_check(struct CodeBuffer* code, long offset, uint8_t reg,
+			  uint8_t jcc, size_t* fixups, size_t* count)
+{
+	code_emit(code, (uint8_t[]){0x48, 0x8D}, 2);
+	code_rbx_mem(code, 0, offset);
+	code_emit(code, (uint8_t[]){0x4C, 0x39, reg}, 3);
+	code_fixup(code, (uint8_t[]){0x0F, jcc}, 2, fixups, count);
+}
+
+static void elf_place_msg(struct CodeBuffer* code, size_t msg_fixup,
+			  const char* msg, size_t len)
+{
+	uint64_t addr = ELF_TEXT_VADDR + ELF_HEADERS_SIZE + code->size;
+	code_emit(code, msg, len);
+	if (!code->failed)
+		memcpy(code->data + msg_fixup, &addr, sizeof(addr));
+}
+
+/*
+ * Emits x86-64 code for a static, libc-free executable.  Registers:
+ * rbx = head, r12/r13 = lowest/highest legal head, r14 = output cursor,
+ * r15 = output buffer, rbp = output buffer end.  I/O goes straight to the
+ * read/write syscalls; output is batched and flushed before reads, on
+ * overflow and at exit.  Bounds are checked like emit_c does.
+ */
+bool elf_compile(struct Program* prog, size_t limit, struct CodeBuffer* code)
+{
+	size_t left	 = tape_left(limit);
+	uint64_t lo	 = ELF_BSS_VADDR + prog->reach;
+	uint64_t hi	 = lo + left + limit - 1;
+	uint64_t out_buf = (ELF_BSS_VADDR + elf_tape_size(prog, limit) + 4095) &
+			   ~4095UL;
+
+	size_t* loop_stack   = malloc(sizeof(size_t) * (prog->size + 1));
+	size_t* flush_fixups = malloc(sizeof(size_t) * (prog->size + 3));
+	size_t* left_fixups  = malloc(sizeof(size_t) * (prog->size + 1));
+	size_t* right_fixups = malloc(sizeof(size_t) * (prog->size + 1));
+	size_t stack_top = 0, flush_count = 0, left_count = 0, right_count = 0;
+
+	if (!loop_stack || !flush_fixups || !left_fixups || !right_fixups) {
+		free(loop_stack);
+		free(flush_fixups);
+		free(left_fixups);
+		free(right_fixups);
+		return false;
+	}
+
+	/* mov r12, lo; mov r13, hi; lea rbx, [r12 + left] */
+	code_emit(code, (uint8_t[]){0x49, 0xBC}, 2);
+	code_u64(code, lo);
+	code_emit(code, (uint8_t[]){0x49, 0xBD}, 2);
+	code_u64(code, hi);
+	code_emit(code, (uint8_t[]){0x49, 0x8D, 0x9C, 0x24}, 4);
+	code_u32(code, (uint32_t)left);
+
+	/* mov r15, out_buf; mov r14, r15; lea rbp, [r15 + size] */
+	code_emit(code, (uint8_t[]){0x49, 0xBF}, 2);
+	code_u64(code, out_buf);
+	code_emit(code, (uint8_t[]){0x4D, 0x89, 0xFE, 0x49, 0x8D, 0xAF}, 6);
+	code_u32(code, (uint32_t)ELF_OUT_BUF_SIZE);
+
+	size_t run_end = 0;
+	for (size_t pc = 0; pc < prog->size; ++pc) {
+		struct Instruction instr = prog->ops[pc];
+
+		if (pc >= run_end) {
+			long min, max;
+			run_end = access_run(prog, pc, &min, &max);
+			if (min < 0)
+				elf_run_check(code, min, 0xE0, 0x82,
+					      left_fixups, &left_count);
+			if (max > 0)
+				elf_run_check(code, max, 0xE8, 0x87,
+					      right_fixups, &right_count);
+		}
+
+		switch (instr.type) {
+		case OperationType_INC_PTR:
+			/* add rbx, imm32; cmp rbx, r13; ja right */
+			code_emit(code, (uint8_t[]){0x48, 0x81, 0xC3}, 3);
+			code_u32(code, (uint32_t)instr.operand);
+			code_emit(code, (uint8_t[]){0x4C, 0x39, 0xEB}, 3);
+			code_fixup(code, (uint8_t[]){0x0F, 0x87}, 2,
+				   right_fixups, &right_count);
+			break;
+
+		case OperationType_DEC_PTR:
+			/* sub rbx, imm32; cmp rbx, r12; jb left */
+			code_emit(code, (uint8_t[]){0x48, 0x81, 0xEB}, 3);
+			code_u32(code, (uint32_t)instr.operand);
+			code_emit(code, (uint8_t[]){0x4C, 0x39, 0xE3}, 3);
+			code_fixup(code, (uint8_t[]){0x0F, 0x82}, 2,
+				   left_fixups, &left_count);
+			break;
+
+		case OperationType_ADD_VAL:
+		case OperationType_SUB_VAL: {
+			uint8_t value = (uint8_t)instr.operand;
+			if (instr.type == OperationType_SUB_VAL)
+				value = (uint8_t)-value;
+
+			/* add byte [rbx + offset], imm8 */
+			code_byte(code, 0x80);
+			code_rbx_mem(code, 0, instr.offset);
+			code_byte(code, value);
+			break;
+		}
+
+		case OperationType_SET_VAL:
+			/* mov byte [rbx + offset], imm8 */
+			code_byte(code, 0xC6);
+			code_rbx_mem(code, 0, instr.offset);
+			code_byte(code, (uint8_t)instr.operand);
+			break;
+
+		case OperationType_MUL_ADD: {
+			uint8_t factor = (uint8_t)instr.operand;
+
+			/* movzx eax, byte [rbx]; imul eax, eax, imm32 */
+			code_emit(code, (uint8_t[]){0x0F, 0xB6, 0x03}, 3);
+			if (factor != 1 && factor != UINT8_MAX) {
+				code_emit(code, (uint8_t[]){0x69, 0xC0}, 2);
+				code_u32(code, factor);
+			}
+			/* add/sub byte [rbx + offset], al */
+			code_byte(code, factor == UINT8_MAX ? 0x28 : 0x00);
+			code_rbx_mem(code, 0, instr.offset);
+			break;
+		}
+
+		case OperationType_OUTPUT:
+			/* movzx eax, byte [rbx + offset]; mov [r14], al; inc r14 */
+			code_emit(code, (uint8_t[]){0x0F, 0xB6}, 2);
+			code_rbx_mem(code, 0, instr.offset);
+			code_emit(code,
+				  (uint8_t[]){0x41, 0x88, 0x06, 0x49, 0xFF,
+					      0xC6},
+				  6);
+			/* cmp r14, rbp; jb +5; call flush */
+			code_emit(code, (uint8_t[]){0x49, 0x39, 0xEE, 0x72, 0x05},
+				  5);
+			code_fixup(code, (uint8_t[]){0xE8}, 1, flush_fixups,
+				   &flush_count);
+			break;
+
+		case OperationType_INPUT:
+			/* call flush; xor eax, eax; xor edi, edi */
+			code_fixup(code, (uint8_t[]){0xE8}, 1, flush_fixups,
+				   &flush_count);
+			code_emit(code, (uint8_t[]){0x31, 0xC0, 0x31, 0xFF}, 4);
+			/* lea rsi, [rbx + offset]; mov edx, 1; syscall */
+			code_byte(code, 0x48);
+			code_byte(code, 0x8D);
+			code_rbx_mem(code, 6, instr.offset);
+			code_emit(code,
+				  (uint8_t[]){0xBA, 0x01, 0x00, 0x00, 0x00, 0x0F,
+					      0x05},
+				  7);
+			break;
+
+		case OperationType_JUMP_ZERO:
+			/* cmp byte [rbx], 0; je <after loop> */
+			code_emit(code,
+				  (uint8_t[]){0x80, 0x3B, 0x00, 0x0F, 0x84}, 5);
+			loop_stack[stack_top++] = code->size;
+			code_u32(code, 0);
+			break;
+
+		case OperationType_JUMP_NONZERO: {
+			size_t open_fixup = loop_stack[--stack_top];
+
+			/* cmp byte [rbx], 0; jne <loop body> */
+			code_emit(code,
+				  (uint8_t[]){0x80, 0x3B, 0x00, 0x0F, 0x85}, 5);
+			size_t close_fixup = code->size;
+			code_u32(code, 0);
+
+			code_patch_rel32(code, close_fixup, open_fixup + 4);
+			code_patch_rel32(code, open_fixup, code->size);
+			break;
+		}
+
+		case OperationType_SCAN_RIGHT:
+		case OperationType_SCAN_LEFT: {
+			bool right = instr.type == OperationType_SCAN_RIGHT;
+
+			/* cmp byte [rbx], 0; je done */
+			size_t top = code->size;
+			code_emit(code, (uint8_t[]){0x80, 0x3B, 0x00, 0x74}, 4);
+			size_t done = code->size;
+			code_byte(code, 0);
+
+			/* add/sub rbx, stride; cmp rbx, r13/r12 */
+			code_emit(code,
+				  (uint8_t[]){0x48, 0x81, right ? 0xC3 : 0xEB},
+				  3);
+			code_u32(code, (uint32_t)instr.operand);
+			code_emit(code,
+				  (uint8_t[]){0x4C, 0x39, right ? 0xEB : 0xE3},
+				  3);
+
+			/* jbe/jae top; jmp right/left */
+			code_byte(code, right ? 0x76 : 0x73);
+			code_byte(code, 0);
+			code_patch_rel8(code, code->size - 1, top);
+			if (right)
+				code_fixup(code, (uint8_t[]){0xE9}, 1,
+					   right_fixups, &right_count);
+			else
+				code_fixup(code, (uint8_t[]){0xE9}, 1,
+					   left_fixups, &left_count);
+			code_patch_rel8(code, done, code->size);
+			break;
+		}
+
+		/* Only fold_constant_prefix writes literals; bfc never folds. */
+		case OperationType_WRITE_LITERAL:
+			break;
+
+		case OperationType_HALT:
+			/* call flush; mov eax, 60; xor edi, edi; syscall */
+			code_fixup(code, (uint8_t[]){0xE8}, 1, flush_fixups,
+				   &flush_count);
+			code_emit(code,
+				  (uint8_t[]){0xB8, 0x3C, 0x00, 0x00, 0x00, 0x31,
+					      0xFF, 0x0F, 0x05},
+				  9);
+			break;
+		}
+	}
+
+	size_t left_msg	 = elf_overflow(code, left_fixups, left_count,
+					flush_fixups, &flush_count,
+					sizeof(elf_left_msg) - 1);
+	size_t right_msg = elf_overflow(code, right_fixups, right_count,
+					flush_fixups, &flush_count,
+					sizeof(elf_right_msg) - 1);
+
+	/*
+	 * flush: write(1, r15, r14 - r15) until done or failed, then reset
+	 * the cursor.
+	 */
+	for (size_t k = 0; k < flush_count; ++k)
+		code_patch_rel32(code, flush_fixups[k], code->size);
+
+	/* mov rdx, r14; sub rdx, r15; mov rsi, r15 */
+	code_emit(code,
+		  (uint8_t[]){0x4C, 0x89, 0xF2, 0x4C, 0x29, 0xFA, 0x4C, 0x89,
+			      0xFE},
+		  9);
+	size_t again = code->size;
+	/* test rdx, rdx; jz done */
+	code_emit(code, (uint8_t[]){0x48, 0x85, 0xD2, 0x74}, 4);
+	size_t done_zero = code->size;
+	code_byte(code, 0);
+	/* mov eax, 1; mov edi, 1; syscall; test rax, rax; jle done */
+	code_emit(code,
+		  (uint8_t[]){0xB8, 0x01, 0x00, 0x00, 0x00, 0xBF, 0x01, 0x00,
+			      0x00, 0x00, 0x0F, 0x05, 0x48, 0x85, 0xC0, 0x7E},
+		  16);
+	size_t done_err = code->size;
+	code_byte(code, 0);
+	/* add rsi, rax; sub rdx, rax; jmp again */
+	code_emit(code, (uint8_t[]){0x48, 0x01, 0xC6, 0x48, 0x29, 0xC2, 0xEB},
+		  7);
+	code_byte(code, 0);
+	code_patch_rel8(code, code->size - 1, again);
+	code_patch_rel8(code, done_zero, code->size);
+	code_patch_rel8(code, done_err, code->size);
+	/* mov r14, r15; ret */
+	code_emit(code, (uint8_t[]){0x4D, 0x89, 0xFE, 0xC3}, 4);
+
+	elf_place_msg(code, left_msg, elf_left_msg, sizeof(elf_left_msg) - 1);
+	elf_place_msg(code, right_msg, elf_right_msg,
+		      sizeof(elf_right_msg) - 1);
+
+	free(loop_stack);
+	free(flush_fixups);
+	free(left_fixups);
+	free(right_fixups);
+
+	if (ELF_TEXT_VADDR + ELF_HEADERS_SIZE + code->size > ELF_BSS_VADDR) {
+		fprintf(stderr, "Error: Program too large for an ELF image.\n");
+		return false;
+	}
+	return !code->failed;
+}
+
+bool emit_elf(struct Program* prog, size_t limit, const char* path)
+{
+	struct CodeBuffer code = {0};
+	if (!elf_compile(prog, limit, &code)) {
+		free(code.data);
+		return false;
+	}
+
+	size_t tape_size = elf_tape_size(prog, limit);
+	size_t bss_size	 = ((tape_size + 4095) & ~4095UL) + ELF_OUT_BUF_SIZE;
+
+	Elf64_Ehdr ehdr = {
+		.e_ident     = {ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3, ELFCLASS64,
+				ELFDATA2LSB, EV_CURRENT, ELFOSABI_SYSV},
+		.e_type	     = ET_EXEC,
+		.e_machine   = EM_X86_64,
+		.e_version   = EV_CURRENT,
+		.e_entry     = ELF_TEXT_VADDR + ELF_HEADERS_SIZE,
+		.e_phoff     = sizeof(Elf64_Ehdr),
+		.e_ehsize    = sizeof(Elf64_Ehdr),
+		.e_phentsize = sizeof(Elf64_Phdr),
+		.e_phnum     = 2,
+	};
+
+	Elf64_Phdr phdrs[2] = {
+		{.p_type   = PT_LOAD,
+		 .p_flags  = PF_R | PF_X,
+		 .p_offset = 0,
+		 .p_vaddr  = ELF_TEXT_VADDR,
+		 .p_paddr  = ELF_TEXT_VADDR,
+		 .p_filesz = ELF_HEADERS_SIZE + code.size,
+		 .p_memsz  = ELF_HEADERS_SIZE + code.size,
+		 .p_align  = 4096},
+		{.p_type   = PT_LOAD,
+		 .p_flags  = PF_R | PF_W,
+		 .p_offset = 0,
+		 .p_vaddr  = ELF_BSS_VADDR,
+		 .p_paddr  = ELF_BSS_VADDR,
+		 .p_filesz = 0,
+		 .p_memsz  = bss_size,
+		 .p_align  = 4096},
+	};
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+	if (fd < 0) {
+		perror("Failed to open output");
+		free(code.data);
+		return false;
+	}
+
+	FILE* out = fdopen(fd, "wb");
+	bool ok	  = out && fwrite(&ehdr, sizeof(ehdr), 1, out) == 1 &&
+		  fwrite(phdrs, sizeof(phdrs), 1, out) == 1 &&
+		  fwrite(code.data, 1, code.size, out) == code.size;
+	if (out ? fclose(out) != 0 : close(fd) != 0)
+		ok = false;
+
+	free(code.data);
+	return ok;
+}
+
+bool run_cc(const char* cc, const char* c_path, const char* output,
+	    bool verbose)
+{
+	char* const args[] = {(char*)cc,     "-O3",	    "-march=native",
+			      "-o",	     (char*)output, (char*)c_path,
+			      nullptr};
+
+	if (verbose)
+		printf("Running %s -O3 -march=native -o %s %s\n", cc, output,
+		       c_path);
+
+	pid_t pid;
+	int err = posix_spawnp(&pid, cc, nullptr, nullptr, args, environ);
+	if (err != 0) {
+		fprintf(stderr, "Error: Failed to run %s: %s\n", cc,
+			strerror(err));
+		return false;
+	}
+
+	int status;
+	if (waitpid(pid, &status, 0) < 0)
+		return false;
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+struct Config {
+	bool verbose;
+	bool emit_c;
+	bool emit_elf;
+	const char* filename;
+	const char* output;
+	const char* cc;
+	size_t max_cells_limit;
+};
+
+void print_usage(const char* prog_name)
+{
+	printf("Usage: %s [options] <file>\n", prog_name);
+	printf("  -h, --help           Show help\n");
+	printf("  -v, --verbose        Verbose output\n");
+	printf("  -o, --output <file>  Output path (a.out default, stdout "
+	       "with -S)\n");
+	printf("  -S, --emit-c         Write the generated C instead of "
+	       "compiling it\n");
+	printf("  -e, --elf            Write a static x86-64 ELF directly, "
+	       "without a C compiler\n");
+	printf("  -c, --cc <compiler>  C compiler to invoke (%s default)\n",
+	       BFC_CC);
+	printf("  -m, --max <cells>    Set max tape length limit (30000 cells "
+	       "default)\n");
+}
+
+int main(int argc, char* argv[])
+{
+	struct Config config = {.verbose	 = false,
+				.emit_c		 = false,
+				.emit_elf	 = false,
+				.filename	 = nullptr,
+				.output		 = nullptr,
+				.cc		 = BFC_CC,
+				.max_cells_limit = 30000};
+
+	static const struct option long_options[] = {
+		{"help", no_argument, 0, 'h'},
+		{"verbose", no_argument, 0, 'v'},
+		{"output", required_argument, 0, 'o'},
+		{"emit-c", no_argument, 0, 'S'},
+		{"elf", no_argument, 0, 'e'},
+		{"cc", required_argument, 0, 'c'},
+		{"max", required_argument, 0, 'm'},
+		{0}};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "hvo:Sec:m:", long_options,
+				  nullptr)) != -1) {
+		switch (opt) {
+		case 'h':
+			print_usage(argv[0]);
+			return 0;
+		case 'v':
+			config.verbose = true;
+			break;
+		case 'o':
+			config.output = optarg;
+			break;
+		case 'S':
+			config.emit_c = true;
+			break;
+		case 'e':
+			config.emit_elf = true;
+			break;
+		case 'c':
+			config.cc = optarg;
+			break;
+		case 'm': {
+			char* endptr;
+			unsigned long long limit =
+				strtoull(optarg, &endptr, 10);
+			if (*endptr != '\0' || limit == 0)
+				return EXIT_FAILURE;
+			config.max_cells_limit = (size_t)limit;
+			break;
+		}
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind < argc) {
+		config.filename = argv[optind];
+	} else {
+		fprintf(stderr, "Error: No input file.\n");
+		print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	struct Source source;
+	if (!source_load(&source, config.filename)) {
+		perror("Failed to read file");
+		return EXIT_FAILURE;
+	}
+
+	struct Program program;
+	if (!program_init(&program)) {
+		fprintf(stderr, "Failed to init program memory.\n");
+		source_free(&source);
+		return EXIT_FAILURE;
+	}
+
+	char* commands = malloc(source.size + STRIP_SLACK);
+	if (!commands) {
+		fprintf(stderr, "Failed to init program memory.\n");
+		source_free(&source);
+		program_free(&program);
+		return EXIT_FAILURE;
+	}
+	size_t command_count = strip_comments(source.data, source.size, commands);
+	enum BfStatus status = compile_source(commands, command_count, &program);
+	free(commands);
+
+	if (status != BfStatus_OK) {
+		fprintf(stderr, "Error: %s\n", bf_status_message(status));
+		fprintf(stderr, "Compilation Failed.\n");
+		source_free(&source);
+		program_free(&program);
+		return EXIT_FAILURE;
+	}
+
+	source_free(&source);
+
+	if (config.verbose)
+		printf("Compilation success. Ops count: %zu\n", program.size);
+
+	if (config.emit_c) {
+		FILE* out = stdout;
+		if (config.output && !(out = fopen(config.output, "w"))) {
+			perror("Failed to open output");
+			program_free(&program);
+			return EXIT_FAILURE;
+		}
+		bool ok = emit_c(&program, config.max_cells_limit, out);
+		if (out != stdout && fclose(out) != 0)
+			ok = false;
+		program_free(&program);
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (config.emit_elf) {
+		bool ok = emit_elf(&program, config.max_cells_limit,
+				   config.output ? config.output : "a.out");
+		program_free(&program);
+		if (!ok) {
+			fprintf(stderr, "Error: ELF emission failed.\n");
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	char c_path[] = "/tmp/bfc-XXXXXX.c";
+	int fd	      = mkstemps(c_path, 2);
+	if (fd < 0) {
+		perror("Failed to create temporary file");
+		program_free(&program);
+		return EXIT_FAILURE;
+	}
+
+	FILE* out = fdopen(fd, "w");
+	bool ok	  = out && emit_c(&program, config.max_cells_limit, out);
+	if (out && fclose(out) != 0)
+		ok = false;
+	program_free(&program);
+
+	if (ok)
+		ok = run_cc(config.cc, c_path,
+			    config.output ? config.output : "a.out",
+			    config.verbose);
+
+	unlink(c_path);
+	if (!ok) {
+		fprintf(stderr, "Error: C compilation failed.\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -1,6 +1,29 @@
+#include <errno.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #define TAPE_SIZE 30000
+#define OUTPUT_BUFFER_SIZE 65536
+
+// 输出先攒在缓冲区里，满了、读输入之前和程序结束时再一次性 write
+static unsigned char output_buffer[OUTPUT_BUFFER_SIZE];
+static size_t output_size = 0;
+
+static void flush_output(void) {
+    size_t done = 0;
+    while (done < output_size) {
+        ssize_t n = write(STDOUT_FILENO, output_buffer + done, output_size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    output_size = 0;
+}
+
+static void put_output(unsigned char c) {
+    output_buffer[output_size++] = c;
+    if (output_size == OUTPUT_BUFFER_SIZE) flush_output();
+}
 
 void brainfuck(const char* code) {
     unsigned char tape[TAPE_SIZE] = {0};
@@ -11,6 +34,7 @@ void brainfuck(const char* code) {
             case '>':
                 ptr++;
                 if (ptr >= TAPE_SIZE) {
+                    flush_output();
                     printf("Error: Pointer out of bounds (right)\n");
                     return;
                 }
@@ -18,6 +42,7 @@ void brainfuck(const char* code) {
             case '<':
                 ptr--;
                 if (ptr < 0) {
+                    flush_output();
                     printf("Error: Pointer out of bounds (left)\n");
                     return;
                 }
@@ -29,9 +54,10 @@ void brainfuck(const char* code) {
                 tape[ptr]--;
                 break;
             case '.':
-                putchar(tape[ptr]);
+                put_output(tape[ptr]);
                 break;
             case ',':
+                flush_output();
                 tape[ptr] = getchar();
                 break;
             case '[':
@@ -68,5 +94,6 @@ int main(int argc, char* argv[]) {
     }
 
     brainfuck(argv[1]);
+    flush_output();
     return 0;
 }
\ No newline at end of file
@@ -1,359 +1,344 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <limits.h>
+#include <setjmp.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-struct Tap {
-	uint8_t* right;
-	size_t right_cap;
-
-	uint8_t* left;
-	size_t left_cap;
-
-	long pos;
-
-	size_t limit;
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "frontend.h"
+#include "source.h"
+#include "tape.h"
+
+/* Names this engine's opcode set in its bytecode cache keys. */
+#define CACHE_FORMAT "bflist"
+
+#define PROFILE_TOP 10
+
+static const char* const operation_names[] = {
+	[OperationType_INC_PTR]	      = "INC_PTR",
+	[OperationType_DEC_PTR]	      = "DEC_PTR",
+	[OperationType_ADD_VAL]	      = "ADD_VAL",
+	[OperationType_SUB_VAL]	      = "SUB_VAL",
+	[OperationType_OUTPUT]	      = "OUTPUT",
+	[OperationType_INPUT]	      = "INPUT",
+	[OperationType_JUMP_ZERO]     = "JUMP_ZERO",
+	[OperationType_JUMP_NONZERO]  = "JUMP_NONZERO",
+	[OperationType_SET_VAL]	      = "SET_VAL",
+	[OperationType_MUL_ADD]	      = "MUL_ADD",
+	[OperationType_SCAN_RIGHT]    = "SCAN_RIGHT",
+	[OperationType_SCAN_LEFT]     = "SCAN_LEFT",
+	[OperationType_WRITE_LITERAL] = "WRITE_LITERAL",
+	[OperationType_HALT]	      = "HALT",
 };
 
-enum OperationType {
-	OperationType_INC_PTR,
-	OperationType_DEC_PTR,
-	OperationType_ADD_VAL,
-	OperationType_SUB_VAL,
-	OperationType_OUTPUT,
-	OperationType_INPUT,
-	OperationType_JUMP_ZERO,
-	OperationType_JUMP_NONZERO,
-	OperationType_SET_ZERO,
-	OperationType_HALT
-};
-
-struct Instruction {
-	enum OperationType type;
-	size_t operand;
-};
-
-struct Program {
-	struct Instruction* ops;
-	size_t size;
-	size_t capacity;
-};
-
-static inline uint8_t* tap_get_ptr(struct Tap* self)
-{
-	if (self->pos >= 0) {
-		return &self->right[self->pos];
-	} else {
-		return &self->left[~self->pos];
-	}
-}
-
-bool tap_init(struct Tap* self, size_t initial_size, size_t limit)
+/* Prints "line:col" for a byte offset into the source. */
+void profile_print_position(FILE* f, const char* source, size_t pos)
 {
-	self->right = calloc(initial_size, sizeof(uint8_t));
-	self->left  = calloc(initial_size, sizeof(uint8_t));
-
-	if (!self->right || !self->left) {
-		if (self->right)
-			free(self->right);
-		if (self->left)
-			free(self->left);
-		return false;
+	size_t line = 1, col = 1;
+	for (size_t i = 0; i < pos; ++i) {
+		if (source[i] == '\n') {
+			line++;
+			col = 1;
+		} else {
+			col++;
+		}
 	}
 
-	self->right_cap = initial_size;
-	self->left_cap	= initial_size;
-	self->limit	= limit;
-	self->pos	= 0;
-	return true;
-}
-
-void tap_deinit(struct Tap* self)
-{
-	if (self->right)
-		free(self->right);
-	if (self->left)
-		free(self->left);
-	self->right = nullptr;
-	self->left  = nullptr;
+	char text[32];
+	snprintf(text, sizeof(text), "%zu:%zu", line, col);
+	fprintf(f, "%-10s", text);
 }
 
-bool tap_move(struct Tap* self, long offset)
+/* The first few commands starting at `pos`, comments dropped. */
+void profile_print_snippet(FILE* f, const char* source, size_t size,
+			   size_t pos)
 {
-	self->pos += offset;
-
-	if (self->pos >= 0) {
-		if ((size_t)self->pos >= self->right_cap) {
-			size_t new_cap = self->right_cap * 2;
-
-			if (new_cap <= (size_t)self->pos)
-				new_cap = (size_t)self->pos + 1;
-
-			if (new_cap > self->limit) {
-				fprintf(stderr, "Error: Tape limit exceeded "
-						"(Right).\n");
-				return false;
-			}
-
-			uint8_t* new_mem = realloc(self->right, new_cap);
-			if (!new_mem)
-				return false;
-
-			memset(new_mem + self->right_cap, 0,
-			       new_cap - self->right_cap);
-
-			self->right	= new_mem;
-			self->right_cap = new_cap;
-		}
-	} else {
-		size_t index = ~self->pos;
-		if (index >= self->left_cap) {
-			size_t new_cap = self->left_cap * 2;
-			if (new_cap <= index)
-				new_cap = index + 1;
-
-			if (new_cap > self->limit) {
-				fprintf(stderr,
-					"Error: Tape limit exceeded (Left).\n");
-				return false;
-			}
-
-			uint8_t* new_mem = realloc(self->left, new_cap);
-			if (!new_mem)
-				return false;
-
-			memset(new_mem + self->left_cap, 0,
-			       new_cap - self->left_cap);
-
-			self->left     = new_mem;
-			self->left_cap = new_cap;
+	size_t shown = 0;
+	for (size_t i = pos; i < size; ++i) {
+		if (!strchr("<>+-.,[]", source[i]))
+			continue;
+		if (shown == 40) {
+			fputs("...", f);
+			break;
 		}
+		fputc(source[i], f);
+		shown++;
 	}
-	return true;
+	fputc('\n', f);
 }
 
-bool program_init(struct Program* prog)
+/* Picks the indexes of the PROFILE_TOP largest scores, largest first. */
+size_t profile_top(const uint64_t* score, size_t n, size_t* top)
 {
-	prog->capacity = 1024;
-	prog->size     = 0;
-	prog->ops      = malloc(sizeof(struct Instruction) * prog->capacity);
-	return prog->ops != nullptr;
+	size_t count = 0;
+	for (size_t k = 0; k < n; ++k) {
+		if (score[k] == 0)
+			continue;
+
+		size_t at = count < PROFILE_TOP ? count++ : PROFILE_TOP;
+		if (at == PROFILE_TOP && score[k] <= score[top[at - 1]])
+			continue;
+		if (at == PROFILE_TOP)
+			at--;
+		while (at > 0 && score[top[at - 1]] < score[k]) {
+			top[at] = top[at - 1];
+			at--;
+		}
+		top[at] = k;
+	}
+	return count;
 }
 
-void program_free(struct Program* prog)
+/*
+ * Loops are charged with every op executed between their brackets, nested
+ * loops included; a loop's iterations are the executions of its first body
+ * op, which is where both the entry and the back-edge land.
+ */
+bool profile_report(struct Program* prog, const uint64_t* counts,
+		    const char* source, size_t size, FILE* f)
 {
-	if (prog->ops)
-		free(prog->ops);
-	prog->ops      = nullptr;
-	prog->size     = 0;
-	prog->capacity = 0;
-}
+	uint64_t* prefix = malloc(sizeof(uint64_t) * (prog->size + 1));
+	uint64_t* inside = calloc(prog->size, sizeof(uint64_t));
+	if (!prefix || !inside) {
+		free(prefix);
+		free(inside);
+		return false;
+	}
 
-bool compile_source(const char* source, struct Program* prog)
-{
-	size_t len = strlen(source);
-	size_t loop_stack[4096];
-	int stack_top = -1;
-
-	for (size_t i = 0; i < len; ++i) {
-		char c			 = source[i];
-		struct Instruction instr = {0};
-		bool emit_instruction	 = true;
-
-		switch (c) {
-		case '>':
-			instr.type    = OperationType_INC_PTR;
-			instr.operand = 1;
-			while (i + 1 < len && source[i + 1] == '>') {
-				instr.operand++;
-				i++;
-			}
-			break;
-		case '<':
-			instr.type    = OperationType_DEC_PTR;
-			instr.operand = 1;
-			while (i + 1 < len && source[i + 1] == '<') {
-				instr.operand++;
-				i++;
-			}
-			break;
-		case '+':
-			instr.type    = OperationType_ADD_VAL;
-			instr.operand = 1;
-			while (i + 1 < len && source[i + 1] == '+') {
-				instr.operand++;
-				i++;
-			}
-			break;
-		case '-':
-			instr.type    = OperationType_SUB_VAL;
-			instr.operand = 1;
-			while (i + 1 < len && source[i + 1] == '-') {
-				instr.operand++;
-				i++;
-			}
-			break;
-		case '.':
-			instr.type = OperationType_OUTPUT;
-			break;
-		case ',':
-			instr.type = OperationType_INPUT;
-			break;
-		case '[':
-
-			if (i + 2 < len &&
-			    (source[i + 1] == '-' || source[i + 1] == '+') &&
-			    source[i + 2] == ']') {
-				instr.type = OperationType_SET_ZERO;
-				i += 2;
-			} else {
-				instr.type = OperationType_JUMP_ZERO;
-				stack_top++;
-				if (stack_top >= 4096)
-					return false;
-				loop_stack[stack_top] = prog->size;
-			}
-			break;
-		case ']':
-			if (stack_top < 0)
-				return false;
-			size_t open_idx = loop_stack[stack_top];
-			stack_top--;
-			instr.type    = OperationType_JUMP_NONZERO;
-			instr.operand = open_idx;
-			prog->ops[open_idx].operand = prog->size;
-			break;
-		default:
-			emit_instruction = false;
-			break;
-		}
+	prefix[0] = 0;
+	for (size_t k = 0; k < prog->size; ++k)
+		prefix[k + 1] = prefix[k] + counts[k];
 
-		if (emit_instruction) {
-			if (prog->size >= prog->capacity) {
-				prog->capacity *= 2;
-				struct Instruction* new_ops = realloc(
-					prog->ops, sizeof(struct Instruction) *
-							   prog->capacity);
-				if (!new_ops)
-					return false;
-				prog->ops = new_ops;
-			}
-			prog->ops[prog->size++] = instr;
-		}
+	for (size_t k = 0; k < prog->size; ++k) {
+		if (prog->ops[k].type == OperationType_JUMP_ZERO)
+			inside[k] = prefix[prog->ops[k].operand + 1] - prefix[k];
 	}
 
-	if (stack_top >= 0) {
-		fprintf(stderr, "Error: Unmatched '['\n");
-		return false;
+	uint64_t total = prefix[prog->size];
+	size_t top[PROFILE_TOP + 1];
+
+	fprintf(f, "\nProfile: %llu ops executed\n",
+		(unsigned long long)total);
+
+	fprintf(f, "\nHottest loops:\n");
+	fprintf(f, "  %-10s %12s %14s %16s %6s  %s\n", "source", "entries",
+		"iterations", "ops inside", "share", "code");
+	size_t n = profile_top(inside, prog->size, top);
+	for (size_t t = 0; t < n; ++t) {
+		size_t k = top[t];
+		fprintf(f, "  ");
+		profile_print_position(f, source, prog->source_pos[k]);
+		fprintf(f, " %12llu %14llu %16llu %5.1f%%  ",
+			(unsigned long long)counts[k],
+			(unsigned long long)counts[k + 1],
+			(unsigned long long)inside[k],
+			total ? 100.0 * (double)inside[k] / (double)total : 0.0);
+		profile_print_snippet(f, source, size, prog->source_pos[k]);
 	}
 
-	if (prog->size >= prog->capacity) {
-		prog->capacity += 1;
-		prog->ops = realloc(prog->ops, sizeof(struct Instruction) *
-						       prog->capacity);
+	fprintf(f, "\nHottest ops:\n");
+	fprintf(f, "  %-10s %-14s %16s %6s  %s\n", "source", "op", "executions",
+		"share", "code");
+	n = profile_top(counts, prog->size, top);
+	for (size_t t = 0; t < n; ++t) {
+		size_t k = top[t];
+		fprintf(f, "  ");
+		profile_print_position(f, source, prog->source_pos[k]);
+		fprintf(f, " %-14s %16llu %5.1f%%  ",
+			operation_names[prog->ops[k].type],
+			(unsigned long long)counts[k],
+			total ? 100.0 * (double)counts[k] / (double)total : 0.0);
+		profile_print_snippet(f, source, size, prog->source_pos[k]);
 	}
-	prog->ops[prog->size].type = OperationType_HALT;
-	prog->size++;
 
+	free(prefix);
+	free(inside);
 	return true;
 }
 
-void tap_run(struct Tap* self, struct Program* prog)
+/*
+ * Instantiated twice below: with counts a constant nullptr the profiling
+ * increment folds away, so normal runs pay nothing for --profile.
+ */
+static inline __attribute__((always_inline)) void
+tap_exec_body(struct Tap* self, const struct Bytecode* code,
+	      struct Output* out, uint64_t* counts)
 {
-	size_t pc = 0;
+	const uint32_t* words = code->words;
+	size_t pc	      = 0;
 
 	uint8_t* curr_ptr = tap_get_ptr(self);
 
-	while (pc < prog->size) {
-		struct Instruction instr = prog->ops[pc];
+	for (;;) {
+		uint32_t w = words[pc];
 
-		switch (instr.type) {
-		case OperationType_INC_PTR:
+		if (counts)
+			counts[pc]++;
 
-			if (!tap_move(self, (long)instr.operand))
-				return;
-            // flush
-			curr_ptr = tap_get_ptr(self);
+		switch ((enum OpCode)WORD_OPCODE(w)) {
+		case OpCode_INC_PTR:
+			curr_ptr += WORD_OPERAND(w);
 			break;
 
-		case OperationType_DEC_PTR:
-			if (!tap_move(self, -(long)instr.operand))
-				return;
-            
-            // flush
-			curr_ptr = tap_get_ptr(self);
+		case OpCode_DEC_PTR:
+			curr_ptr -= WORD_OPERAND(w);
 			break;
 
-		case OperationType_ADD_VAL:
-
-			*curr_ptr += (uint8_t)instr.operand;
+		case OpCode_ADD_VAL:
+			curr_ptr[WORD_OFFSET(w)] += WORD_VALUE(w);
 			break;
 
-		case OperationType_SUB_VAL:
-			*curr_ptr -= (uint8_t)instr.operand;
+		case OpCode_SUB_VAL:
+			curr_ptr[WORD_OFFSET(w)] -= WORD_VALUE(w);
 			break;
 
-		case OperationType_OUTPUT:
-			putchar(*curr_ptr);
+		case OpCode_OUTPUT:
+			output_put(out, curr_ptr[WORD_OFFSET(w)]);
 			break;
 
-		case OperationType_INPUT: {
+		case OpCode_INPUT: {
+			output_flush(out);
 			int c = getchar();
 			if (c != EOF)
-				*curr_ptr = (uint8_t)c;
+				curr_ptr[WORD_OFFSET(w)] = (uint8_t)c;
 			break;
 		}
 
-		case OperationType_JUMP_ZERO:
+		case OpCode_JUMP_ZERO:
+			if (*curr_ptr == 0) {
+				pc = WORD_OPERAND(w);
+				continue;
+			}
+			break;
+
+		case OpCode_JUMP_NONZERO:
+			if (*curr_ptr != 0) {
+				pc = WORD_OPERAND(w);
+				continue;
+			}
+			break;
+
+		case OpCode_SET_VAL:
+			curr_ptr[WORD_OFFSET(w)] = WORD_VALUE(w);
+			break;
+
+		case OpCode_MUL_ADD:
+			curr_ptr[WORD_OFFSET(w)] += *curr_ptr * WORD_VALUE(w);
+			break;
+
+		case OpCode_SCAN_RIGHT:
+			curr_ptr = tap_scan_right(self, curr_ptr, WORD_OPERAND(w));
+			break;
+
+		case OpCode_SCAN_LEFT:
+			curr_ptr = tap_scan_left(self, curr_ptr, WORD_OPERAND(w));
+			break;
+
+		case OpCode_WRITE_LITERAL:
+			output_write(out, code->data + bytecode_wide(words + pc + 3),
+				     bytecode_wide(words + pc + 1));
+			pc += 4;
+			break;
+
+		case OpCode_HALT:
+			return;
+
+		case OpCode_INC_PTR_WIDE:
+			curr_ptr += bytecode_wide(words + pc + 1);
+			pc += 2;
+			break;
 
+		case OpCode_DEC_PTR_WIDE:
+			curr_ptr -= bytecode_wide(words + pc + 1);
+			pc += 2;
+			break;
+
+		case OpCode_JUMP_ZERO_WIDE:
 			if (*curr_ptr == 0) {
-				pc = instr.operand;
+				pc = bytecode_wide(words + pc + 1);
+				continue;
 			}
+			pc += 2;
 			break;
 
-		case OperationType_JUMP_NONZERO:
+		case OpCode_JUMP_NONZERO_WIDE:
 			if (*curr_ptr != 0) {
-				pc = instr.operand;
+				pc = bytecode_wide(words + pc + 1);
+				continue;
 			}
+			pc += 2;
+			break;
+
+		case OpCode_SCAN_RIGHT_WIDE:
+			curr_ptr = tap_scan_right(self, curr_ptr,
+						  bytecode_wide(words + pc + 1));
+			pc += 2;
 			break;
 
-		case OperationType_SET_ZERO:
-			*curr_ptr = 0;
+		case OpCode_SCAN_LEFT_WIDE:
+			curr_ptr = tap_scan_left(self, curr_ptr,
+						 bytecode_wide(words + pc + 1));
+			pc += 2;
 			break;
 
-		case OperationType_HALT:
+		/* Only bftail and bfblackmagic fuse superinstructions. */
+#define SUPER_CASE(first, second) case OpCode_##first##_##second:
+		SUPERINSTRUCTIONS(SUPER_CASE)
+#undef SUPER_CASE
+		case OpCode_COUNT:
 			return;
 		}
 		pc++;
 	}
 }
 
-char* read_file(const char* filename)
+static void tap_exec_plain(struct Tap* self, const struct Bytecode* code,
+			   struct Output* out)
+{
+	tap_exec_body(self, code, out, nullptr);
+}
+
+static void tap_exec_profiled(struct Tap* self, const struct Bytecode* code,
+			      struct Output* out, uint64_t* counts)
+{
+	tap_exec_body(self, code, out, counts);
+}
+
+/*
+ * Tape faults past the limit unwind back here through tap_fault.  `counts`
+ * is non-null under --profile and gets one counter per bytecode word.
+ */
+void tap_run(struct Tap* self, const struct Bytecode* code,
+	     struct Output* out, uint64_t* counts)
 {
-	FILE* f = fopen(filename, "rb");
-	if (!f)
-		return nullptr;
-	fseek(f, 0, SEEK_END);
-	long length = ftell(f);
-	fseek(f, 0, SEEK_SET);
-	char* buffer = malloc(length + 1);
-	if (buffer) {
-		fread(buffer, 1, length, f);
-		buffer[length] = '\0';
+	if (sigsetjmp(self->escape, 1) != 0) {
+		tap_report_fault(self->fault);
+		return;
 	}
-	fclose(f);
-	return buffer;
+	if (counts)
+		tap_exec_profiled(self, code, out, counts);
+	else
+		tap_exec_plain(self, code, out);
 }
 
 struct Config {
 	size_t tape_size;
 	bool verbose;
+	bool line_buffered;
 	const char* filename;
 	size_t max_cells_limit;
+	const char* cache_dir;
+	bool profile;
 };
 
 void print_usage(const char* prog_name)
@@ -361,10 +346,71 @@ void print_usage(const char* prog_name)
 	printf("Usage: %s [options] <file>\n", prog_name);
 	printf("  -h, --help           Show help\n");
 	printf("  -v, --verbose        Verbose output\n");
+	printf("  -l, --line-buffered  Flush program output at every "
+	       "newline\n");
 	printf("  -s, --size <cells>   Initial tape size (1024 cells "
 	       "default)\n");
 	printf("  -m, --max <cells>    Set max tape length limit (30000 cells "
 	       "default)\n");
+	printf("  -c, --cache <dir>    Reuse compiled bytecode cached in "
+	       "<dir>\n");
+	printf("  -p, --profile        Count every op and loop and report the "
+	       "hottest\n");
+}
+
+/*
+ * Runs the whole front end, from source to runnable bytecode.  Prints what
+ * went wrong and returns false on failure.
+ */
+bool build_bytecode(const struct Source* source, const struct Config* config,
+		    struct Program* program, struct Bytecode* code)
+{
+	if (config->verbose)
+		printf("Compiling...\n");
+
+	/*
+	 * --profile points back into the source, so it lexes the text as
+	 * is; everything else lexes the commands alone.
+	 */
+	const char* text = source->data;
+	size_t size	 = source->size;
+	char* commands	 = nullptr;
+	if (!config->profile) {
+		commands = malloc(source->size + STRIP_SLACK);
+		if (!commands) {
+			fprintf(stderr, "Failed to init program memory.\n");
+			return false;
+		}
+		size = strip_comments(source->data, source->size, commands);
+		text = commands;
+	}
+	enum BfStatus status = compile_source(text, size, program);
+	free(commands);
+	if (status != BfStatus_OK)
+		fprintf(stderr, "Error: %s\n", bf_status_message(status));
+
+	if (status != BfStatus_OK ||
+	    !fold_constant_prefix(program, config->max_cells_limit)) {
+		fprintf(stderr, "Compilation Failed.\n");
+		return false;
+	}
+
+	if (config->verbose)
+		printf("Compilation success. Ops count: %zu\n", program->size);
+
+	if (!bytecode_compile(program, code)) {
+		fprintf(stderr, "Compilation Failed.\n");
+		return false;
+	}
+
+	if (config->verbose)
+		printf("Bytecode: %zu bytes, %.1f ops per 64-byte cache line "
+		       "(%.1f unpacked)\n",
+		       code->size * sizeof(uint32_t),
+		       64.0 * (double)program->size /
+			       (double)(code->size * sizeof(uint32_t)),
+		       64.0 / (double)sizeof(struct Instruction));
+	return true;
 }
 
 int main(int argc, char* argv[])
@@ -372,17 +418,21 @@ int main(int argc, char* argv[])
 	struct Config config = {.tape_size	 = 1024,
 				.verbose	 = false,
 				.filename	 = nullptr,
-				.max_cells_limit = 30000};
+				.max_cells_limit = 30000,
+				.line_buffered	 = false};
 
 	static const struct option long_options[] = {
 		{"help", no_argument, 0, 'h'},
 		{"verbose", no_argument, 0, 'v'},
+		{"line-buffered", no_argument, 0, 'l'},
 		{"size", required_argument, 0, 's'},
 		{"max", required_argument, 0, 'm'},
+		{"cache", required_argument, 0, 'c'},
+		{"profile", no_argument, 0, 'p'},
 		{0}};
 
 	int opt;
-	while ((opt = getopt_long(argc, argv, "hvs:m:", long_options,
+	while ((opt = getopt_long(argc, argv, "hvlps:m:c:", long_options,
 				  nullptr)) != -1) {
 		switch (opt) {
 		case 'h':
@@ -391,6 +441,12 @@ int main(int argc, char* argv[])
 		case 'v':
 			config.verbose = true;
 			break;
+		case 'l':
+			config.line_buffered = true;
+			break;
+		case 'p':
+			config.profile = true;
+			break;
 		case 's': {
 			char* endptr;
 			unsigned long long size = strtoull(optarg, &endptr, 10);
@@ -408,6 +464,9 @@ int main(int argc, char* argv[])
 			config.max_cells_limit = (size_t)limit;
 			break;
 		}
+		case 'c':
+			config.cache_dir = optarg;
+			break;
 		default:
 			return EXIT_FAILURE;
 		}
@@ -421,46 +480,105 @@ int main(int argc, char* argv[])
 		return EXIT_FAILURE;
 	}
 
-	char* source_code = read_file(config.filename);
-	if (!source_code) {
+	struct Source source;
+	if (!source_load(&source, config.filename)) {
 		perror("Failed to read file");
 		return EXIT_FAILURE;
 	}
 
-	if (config.verbose)
-		printf("Compiling...\n");
-
 	struct Program program;
 	if (!program_init(&program)) {
 		fprintf(stderr, "Failed to init program memory.\n");
-		free(source_code);
+		source_free(&source);
 		return EXIT_FAILURE;
 	}
 
-	if (!compile_source(source_code, &program)) {
-		fprintf(stderr, "Compilation Failed.\n");
-		free(source_code);
-		program_free(&program);
-		return EXIT_FAILURE;
+	/* --profile needs the Program itself, which a cache hit never builds. */
+	char cache_file[PATH_MAX];
+	uint64_t key = cache_key(CACHE_FORMAT, source.data, source.size,
+				 config.max_cells_limit);
+	bool use_cache = config.cache_dir && !config.profile &&
+			 cache_path(cache_file, sizeof(cache_file),
+				    config.cache_dir, key);
+
+	struct Bytecode code;
+	const struct CacheHeader* cached =
+		use_cache ? cache_load(cache_file, key, source.size,
+				     false, &code)
+			  : nullptr;
+
+	size_t margin;
+	if (cached) {
+		margin = cached->margin;
+		if (config.verbose)
+			printf("Loaded %llu ops from %s\n",
+			       (unsigned long long)cached->ops, cache_file);
+	} else {
+		if (!build_bytecode(&source, &config, &program, &code)) {
+			source_free(&source);
+			program_free(&program);
+			return EXIT_FAILURE;
+		}
+		margin = program.reach + program.travel;
+
+		if (use_cache) {
+			/* The cache directory itself is created on demand. */
+			mkdir(config.cache_dir, 0777);
+			bool stored = cache_store(cache_file, key, source.size,
+						  &program, &code);
+			if (config.verbose)
+				printf("%s %s\n",
+				       stored ? "Cached bytecode in"
+					      : "Failed to cache bytecode in",
+				       cache_file);
+		}
 	}
 
-	free(source_code);
-
-	if (config.verbose)
-		printf("Compilation success. Ops count: %zu\n", program.size);
+	static struct Output output = {.fd = STDOUT_FILENO};
+	output.line_buffered	     = config.line_buffered;
+
+	uint64_t* counts = nullptr;
+	if (config.profile) {
+		counts = calloc(code.size, sizeof(uint64_t));
+		if (!counts) {
+			fprintf(stderr, "Failed to allocate profile counters.\n");
+			source_free(&source);
+			bytecode_free(&code);
+			program_free(&program);
+			return EXIT_FAILURE;
+		}
+	}
 
 	struct Tap tap;
-	if (!tap_init(&tap, config.tape_size, config.max_cells_limit)) {
+	if (!tap_init(&tap, config.tape_size, config.max_cells_limit,
+		      margin)) {
 		fprintf(stderr, "Failed to initialize tap.\n");
+		free(counts);
+		source_free(&source);
+		bytecode_free(&code);
 		program_free(&program);
 		return EXIT_FAILURE;
 	}
 
 	if (config.verbose)
 		printf("Running...\n");
-	tap_run(&tap, &program);
+	fflush(stdout);
+
+	tap_run(&tap, &code, &output, counts);
+	output_flush(&output);
+
+	if (counts) {
+		/* Per word to per op, in place: word_at[k] >= k. */
+		for (size_t k = 0; k < program.size; ++k)
+			counts[k] = counts[code.word_at[k]];
+		profile_report(&program, counts, source.data, source.size,
+			       stderr);
+	}
 
+	free(counts);
+	source_free(&source);
 	tap_deinit(&tap);
+	bytecode_free(&code);
 	program_free(&program);
 	return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -1,3 +1,6 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <limits.h>
 #include <stdbool.h>
@@ -6,22 +9,36 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "source.h"
+#include "strip.h"
+
+#define TAP_CHUNK_SIZE 1024
+
+/*
+ * Cells live in fixed-size chunks reached through a small directory, so a
+ * move by N is index arithmetic plus one lookup.  [lo, hi) are the cells the
+ * tape has grown to so far, as indexes into the chunked space.
+ *
+ * The directory is `chunk_count` entries from `chunks`, somewhere inside an
+ * allocation of `slot_count` that keeps free slots on both sides.  When a
+ * side runs out it doubles and recentres, so adding a chunk at either end
+ * costs amortized O(1) however long the tape gets.
+ */
+struct Tap {
+	uint8_t** chunks;
+	size_t chunk_count;
+	uint8_t** slots;
+	size_t slot_count;
 
-struct Node {
-	struct Node* prev;
-	struct Node* next;
-	uint8_t data;
-};
-
-static struct Node TOMP = {.prev = nullptr, .next = nullptr, .data = UINT8_MAX};
-
-bool node_is_tomp(struct Node* node)
-{
-	return node == &TOMP;
-}
+	size_t lo;
+	size_t hi;
+	size_t index;
+	uint8_t* cell;
 
-struct Tap {
-	struct Node* cell;
 	size_t cells_limit;
 	size_t current_cells_size;
 };
@@ -50,32 +67,43 @@ struct Program {
 	size_t capacity;
 };
 
-struct Node* create_chunk(size_t count)
+uint8_t* create_chunk(void)
 {
-	struct Node* cells = malloc(sizeof(struct Node) * count);
-	if (cells == nullptr)
-		return nullptr;
-
-	memset(cells, 0, sizeof(struct Node) * count);
+	return calloc(TAP_CHUNK_SIZE, sizeof(uint8_t));
+}
 
-	for (size_t i = 0; i < count; ++i) {
-		cells[i].prev = (i == 0) ? nullptr : &cells[i - 1];
-		cells[i].next = (i == count - 1) ? nullptr : &cells[i + 1];
-		cells[i].data = 0;
-	}
-	return cells;
+static inline uint8_t* tap_cell_at(struct Tap* self, size_t index)
+{
+	return &self->chunks[index / TAP_CHUNK_SIZE][index % TAP_CHUNK_SIZE];
 }
 
 bool tap_init(struct Tap* self, size_t initial_size, size_t max_cells)
 {
-	struct Node* cells = create_chunk(initial_size);
-	if (!cells)
+	size_t count = (initial_size + TAP_CHUNK_SIZE - 1) / TAP_CHUNK_SIZE;
+
+	self->slots = calloc(count, sizeof(uint8_t*));
+	if (!self->slots)
 		return false;
+	self->slot_count  = count;
+	self->chunks	  = self->slots;
+	self->chunk_count = count;
 
-	cells[0].prev		     = &TOMP;
-	cells[initial_size - 1].next = &TOMP;
+	for (size_t i = 0; i < count; ++i) {
+		self->chunks[i] = create_chunk();
+		if (!self->chunks[i]) {
+			while (i--)
+				free(self->chunks[i]);
+			free(self->slots);
+			self->slots  = nullptr;
+			self->chunks = nullptr;
+			return false;
+		}
+	}
 
-	self->cell		 = &cells[initial_size / 2];
+	self->lo		 = 0;
+	self->hi		 = initial_size;
+	self->index		 = initial_size / 2;
+	self->cell		 = tap_cell_at(self, self->index);
 	self->cells_limit	 = max_cells;
 	self->current_cells_size = initial_size;
 	return true;
@@ -83,26 +111,42 @@ bool tap_init(struct Tap* self, size_t initial_size, size_t max_cells)
 
 void tap_deinit(struct Tap* self)
 {
-	if (self == nullptr || self->cell == nullptr)
+	if (self == nullptr || self->chunks == nullptr)
 		return;
 
-	struct Node* head = self->cell;
-	while (!node_is_tomp(head->prev)) {
-		head = head->prev;
-	}
+	for (size_t i = 0; i < self->chunk_count; ++i)
+		free(self->chunks[i]);
+	free(self->slots);
+	self->slots  = nullptr;
+	self->chunks = nullptr;
+	self->cell   = nullptr;
+}
 
-	struct Node* current_chunk_start = head;
-	while (!node_is_tomp(current_chunk_start)) {
-		struct Node* scanner = current_chunk_start;
-		while (!node_is_tomp(scanner->next) &&
-		       (scanner->next == scanner + 1)) {
-			scanner = scanner->next;
-		}
-		struct Node* next_chunk_start = scanner->next;
-		free(current_chunk_start);
-		current_chunk_start = next_chunk_start;
-	}
-	self->cell = nullptr;
+/*
+ * Makes room for one more directory entry before the first chunk (`left`)
+ * or after the last, doubling the directory when that side is full.
+ */
+bool tap_reserve(struct Tap* self, bool left)
+{
+	size_t front = (size_t)(self->chunks - self->slots);
+	size_t back  = self->slot_count - front - self->chunk_count;
+	if (left ? front > 0 : back > 0)
+		return true;
+
+	/* At least one free slot either side of the chunks. */
+	size_t count	= (self->chunk_count + 1) * 2;
+	uint8_t** slots = malloc(sizeof(uint8_t*) * count);
+	if (!slots)
+		return false;
+
+	size_t start = (count - self->chunk_count) / 2;
+	memcpy(slots + start, self->chunks,
+	       sizeof(uint8_t*) * self->chunk_count);
+	free(self->slots);
+	self->slots	 = slots;
+	self->slot_count = count;
+	self->chunks	 = slots + start;
+	return true;
 }
 
 bool tap_resize_right(struct Tap* self)
@@ -111,16 +155,20 @@ bool tap_resize_right(struct Tap* self)
 		fprintf(stderr, "Error: Tape limit exceeded!\n");
 		return false;
 	}
-	size_t size	       = 1024;
-	struct Node* new_chunk = create_chunk(size);
-	if (!new_chunk)
-		return false;
 
-	struct Node* old_tail	 = self->cell;
-	old_tail->next		 = &new_chunk[0];
-	new_chunk[0].prev	 = old_tail;
-	new_chunk[size - 1].next = &TOMP;
-	self->current_cells_size += 1024;
+	size_t hi = self->hi + TAP_CHUNK_SIZE;
+	while (self->chunk_count * TAP_CHUNK_SIZE < hi) {
+		if (!tap_reserve(self, false))
+			return false;
+
+		uint8_t* new_chunk = create_chunk();
+		if (!new_chunk)
+			return false;
+		self->chunks[self->chunk_count++] = new_chunk;
+	}
+
+	self->hi = hi;
+	self->current_cells_size += TAP_CHUNK_SIZE;
 	return true;
 }
 
@@ -130,16 +178,45 @@ bool tap_resize_left(struct Tap* self)
 		fprintf(stderr, "Error: Tape limit exceeded!\n");
 		return false;
 	}
-	size_t size	       = 1024;
-	struct Node* new_chunk = create_chunk(size);
-	if (!new_chunk)
-		return false;
 
-	struct Node* old_head	 = self->cell;
-	old_head->prev		 = &new_chunk[size - 1];
-	new_chunk[size - 1].next = old_head;
-	new_chunk[0].prev	 = &TOMP;
-	self->current_cells_size += 1024;
+	if (self->lo < TAP_CHUNK_SIZE) {
+		if (!tap_reserve(self, true))
+			return false;
+
+		uint8_t* new_chunk = create_chunk();
+		if (!new_chunk)
+			return false;
+		*--self->chunks = new_chunk;
+		self->chunk_count++;
+
+		self->lo += TAP_CHUNK_SIZE;
+		self->hi += TAP_CHUNK_SIZE;
+		self->index += TAP_CHUNK_SIZE;
+	}
+
+	self->lo -= TAP_CHUNK_SIZE;
+	self->current_cells_size += TAP_CHUNK_SIZE;
+	return true;
+}
+
+/* Grows the tape one chunk at a time until the head fits, like the walk did. */
+bool tap_move(struct Tap* self, long offset)
+{
+	if (offset > 0) {
+		while (self->index + (size_t)offset >= self->hi) {
+			if (!tap_resize_right(self))
+				return false;
+		}
+		self->index += (size_t)offset;
+	} else {
+		while (self->index - self->lo < (size_t)-offset) {
+			if (!tap_resize_left(self))
+				return false;
+		}
+		self->index -= (size_t)-offset;
+	}
+
+	self->cell = tap_cell_at(self, self->index);
 	return true;
 }
 
@@ -160,11 +237,38 @@ void program_free(struct Program* prog)
 	prog->capacity = 0;
 }
 
-bool compile_source(const char* source, struct Program* prog)
+/* A growable stack of op indexes, so loops nest as deep as memory allows. */
+struct IndexStack {
+	size_t* items;
+	size_t size;
+	size_t capacity;
+};
+
+bool index_stack_push(struct IndexStack* self, size_t index)
+{
+	if (self->size == self->capacity) {
+		size_t new_cap	  = self->capacity ? self->capacity * 2 : 64;
+		size_t* new_items = realloc(self->items, sizeof(size_t) * new_cap);
+		if (!new_items)
+			return false;
+		self->items    = new_items;
+		self->capacity = new_cap;
+	}
+	self->items[self->size++] = index;
+	return true;
+}
+
+void index_stack_free(struct IndexStack* self)
+{
+	free(self->items);
+	self->items    = nullptr;
+	self->size     = 0;
+	self->capacity = 0;
+}
+
+bool compile_commands(const char* source, size_t len, struct Program* prog,
+		      struct IndexStack* open)
 {
-	size_t len = strlen(source);
-	size_t loop_stack[4096];
-	int stack_top = -1;
 
 	for (size_t i = 0; i < len; ++i) {
 		char c			 = source[i];
@@ -218,17 +322,14 @@ bool compile_source(const char* source, struct Program* prog)
 				i += 2;
 			} else {
 				instr.type = OperationType_JUMP_ZERO;
-				stack_top++;
-				if (stack_top >= 4096)
+				if (!index_stack_push(open, prog->size))
 					return false;
-				loop_stack[stack_top] = prog->size;
 			}
 			break;
 		case ']':
-			if (stack_top < 0)
+			if (open->size == 0)
 				return false;
-			size_t open_idx = loop_stack[stack_top];
-			stack_top--;
+			size_t open_idx = open->items[--open->size];
 			instr.type    = OperationType_JUMP_NONZERO;
 			instr.operand = open_idx;
 
@@ -253,7 +354,7 @@ bool compile_source(const char* source, struct Program* prog)
 		}
 	}
 
-	if (stack_top >= 0) {
+	if (open->size > 0) {
 		fprintf(stderr, "Error: Unmatched '['\n");
 		return false;
 	}
@@ -269,7 +370,55 @@ bool compile_source(const char* source, struct Program* prog)
 	return true;
 }
 
-void tap_run(struct Tap* self, struct Program* prog)
+bool compile_source(const char* source, size_t len, struct Program* prog)
+{
+	struct IndexStack open = {0};
+	bool ok		       = compile_commands(source, len, prog, &open);
+	index_stack_free(&open);
+	return ok;
+}
+
+#define OUTPUT_BUFFER_SIZE 65536
+
+/*
+ * Program output is collected here and handed to write(2) in bulk: when the
+ * buffer fills, before every input op, at the end of the run and, with
+ * --line-buffered, after every newline.
+ */
+struct Output {
+	uint8_t data[OUTPUT_BUFFER_SIZE];
+	size_t size;
+	int fd;
+	bool line_buffered;
+};
+
+bool output_flush(struct Output* self)
+{
+	size_t done = 0;
+	while (done < self->size) {
+		ssize_t n = write(self->fd, self->data + done, self->size - done);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			self->size = 0;
+			return false;
+		}
+		done += (size_t)n;
+	}
+	self->size = 0;
+	return true;
+}
+
+static inline bool output_put(struct Output* self, uint8_t c)
+{
+	self->data[self->size++] = c;
+	if (self->size == OUTPUT_BUFFER_SIZE ||
+	    (self->line_buffered && c == '\n'))
+		return output_flush(self);
+	return true;
+}
+
+void tap_run(struct Tap* self, struct Program* prog, struct Output* out)
 {
 	size_t pc = 0;
 
@@ -278,58 +427,47 @@ void tap_run(struct Tap* self, struct Program* prog)
 
 		switch (instr.type) {
 		case OperationType_INC_PTR:
-			for (size_t k = 0; k < instr.operand; k++) {
-				if (node_is_tomp(self->cell->next)) {
-					if (!tap_resize_right(self)) {
-						fprintf(stderr,
-							"Runtime Error: Memory "
-							"limit exceeded\n");
-						return;
-					}
-				}
-				self->cell = self->cell->next;
+			if (!tap_move(self, (long)instr.operand)) {
+				fprintf(stderr,
+					"Runtime Error: Memory limit exceeded\n");
+				return;
 			}
 			break;
 		case OperationType_DEC_PTR:
-			for (size_t k = 0; k < instr.operand; k++) {
-				if (node_is_tomp(self->cell->prev)) {
-					if (!tap_resize_left(self)) {
-						fprintf(stderr,
-							"Runtime Error: Memory "
-							"limit exceeded\n");
-						return;
-					}
-				}
-				self->cell = self->cell->prev;
+			if (!tap_move(self, -(long)instr.operand)) {
+				fprintf(stderr,
+					"Runtime Error: Memory limit exceeded\n");
+				return;
 			}
 			break;
 		case OperationType_ADD_VAL:
-			self->cell->data += (uint8_t)instr.operand;
+			*self->cell += (uint8_t)instr.operand;
 			break;
 		case OperationType_SUB_VAL:
-			self->cell->data -= (uint8_t)instr.operand;
+			*self->cell -= (uint8_t)instr.operand;
 			break;
 		case OperationType_OUTPUT:
-			putchar(self->cell->data);
+			output_put(out, *self->cell);
 			break;
 		case OperationType_INPUT: {
+			output_flush(out);
 			int c = getchar();
 			if (c != EOF)
-				self->cell->data = (uint8_t)c;
+				*self->cell = (uint8_t)c;
 			break;
 		}
 		case OperationType_JUMP_ZERO:
-			if (self->cell->data == 0) {
+			if (*self->cell == 0) {
 				pc = instr.operand;
 			}
 			break;
 		case OperationType_JUMP_NONZERO:
-			if (self->cell->data != 0) {
+			if (*self->cell != 0) {
 				pc = instr.operand;
 			}
 			break;
 		case OperationType_SET_ZERO:
-			self->cell->data = 0;
+			*self->cell = 0;
 			break;
 		case OperationType_HALT:
 			return;
@@ -338,26 +476,10 @@ void tap_run(struct Tap* self, struct Program* prog)
 	}
 }
 
-char* read_file(const char* filename)
-{
-	FILE* f = fopen(filename, "rb");
-	if (!f)
-		return nullptr;
-	fseek(f, 0, SEEK_END);
-	long length = ftell(f);
-	fseek(f, 0, SEEK_SET);
-	char* buffer = malloc(length + 1);
-	if (buffer) {
-		fread(buffer, 1, length, f);
-		buffer[length] = '\0';
-	}
-	fclose(f);
-	return buffer;
-}
-
 struct Config {
 	size_t tape_size;
 	bool verbose;
+	bool line_buffered;
 	const char* filename;
 	size_t max_cells_limit;
 };
@@ -367,6 +489,8 @@ void print_usage(const char* prog_name)
 	printf("Usage: %s [options] <file>\n", prog_name);
 	printf("  -h, --help           Show help\n");
 	printf("  -v, --verbose        Verbose output\n");
+	printf("  -l, --line-buffered  Flush program output at every "
+	       "newline\n");
 	printf("  -s, --size <cells>   Initial tape size (1024 cells "
 	       "default)\n");
 	printf("  -m, --max <cells>    Set max tape length limit (30000 cells "
@@ -378,17 +502,19 @@ int main(int argc, char* argv[])
 	struct Config config = {.tape_size	 = 1024,
 				.verbose	 = false,
 				.filename	 = nullptr,
-				.max_cells_limit = 30000};
+				.max_cells_limit = 30000,
+				.line_buffered	 = false};
 
 	static const struct option long_options[] = {
 		{"help", no_argument, 0, 'h'},
 		{"verbose", no_argument, 0, 'v'},
+		{"line-buffered", no_argument, 0, 'l'},
 		{"size", required_argument, 0, 's'},
 		{"max", required_argument, 0, 'm'},
 		{0}};
 
 	int opt;
-	while ((opt = getopt_long(argc, argv, "hvs:m:", long_options,
+	while ((opt = getopt_long(argc, argv, "hvls:m:", long_options,
 				  nullptr)) != -1) {
 		switch (opt) {
 		case 'h':
@@ -397,6 +523,9 @@ int main(int argc, char* argv[])
 		case 'v':
 			config.verbose = true;
 			break;
+		case 'l':
+			config.line_buffered = true;
+			break;
 		case 's': {
 			char* endptr;
 			unsigned long long size = strtoull(optarg, &endptr, 10);
@@ -427,8 +556,8 @@ int main(int argc, char* argv[])
 		return EXIT_FAILURE;
 	}
 
-	char* source_code = read_file(config.filename);
-	if (!source_code) {
+	struct Source source;
+	if (!source_load(&source, config.filename)) {
 		perror("Failed to read file");
 		return EXIT_FAILURE;
 	}
@@ -439,22 +568,36 @@ int main(int argc, char* argv[])
 	struct Program program;
 	if (!program_init(&program)) {
 		fprintf(stderr, "Failed to init program memory.\n");
-		free(source_code);
+		source_free(&source);
+		return EXIT_FAILURE;
+	}
+
+	char* commands = malloc(source.size + STRIP_SLACK);
+	if (!commands) {
+		fprintf(stderr, "Failed to init program memory.\n");
+		source_free(&source);
+		program_free(&program);
 		return EXIT_FAILURE;
 	}
+	size_t command_count = strip_comments(source.data, source.size, commands);
+	bool compiled	     = compile_source(commands, command_count, &program);
+	free(commands);
 
-	if (!compile_source(source_code, &program)) {
+	if (!compiled) {
 		fprintf(stderr, "Compilation Failed.\n");
-		free(source_code);
+		source_free(&source);
 		program_free(&program);
 		return EXIT_FAILURE;
 	}
 
-	free(source_code);
+	source_free(&source);
 
 	if (config.verbose)
 		printf("Compilation success. Ops count: %zu\n", program.size);
 
+	static struct Output output = {.fd = STDOUT_FILENO};
+	output.line_buffered	     = config.line_buffered;
+
 	struct Tap tap;
 	if (!tap_init(&tap, config.tape_size, config.max_cells_limit)) {
 		fprintf(stderr, "Failed to initialize tap.\n");
@@ -464,7 +607,10 @@ int main(int argc, char* argv[])
 
 	if (config.verbose)
 		printf("Running...\n");
-	tap_run(&tap, &program);
+	fflush(stdout);
+
+	tap_run(&tap, &program, &output);
+	output_flush(&output);
 
 	tap_deinit(&tap);
 	program_free(&program);
@@ -0,0 +1,169 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bf.h"
+#include "source.h"
+
+/*
+ * bfrun: the command-line front of libbf.  It runs programs like bflist
+ * does, through the library, and adds what only the library offers: a
+ * fuel limit that stops runaway programs after a set amount of work.
+ */
+
+/* Program I/O is plain stdin and stdout; libbf does the buffering. */
+static size_t stdin_read(void* user, uint8_t* data, size_t size)
+{
+	(void)user;
+	for (;;) {
+		ssize_t n = read(STDIN_FILENO, data, size);
+		if (n >= 0)
+			return (size_t)n;
+		if (errno != EINTR)
+			return 0;
+	}
+}
+
+static bool stdout_write(void* user, const uint8_t* data, size_t size)
+{
+	(void)user;
+	while (size > 0) {
+		ssize_t n = write(STDOUT_FILENO, data, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		data += n;
+		size -= (size_t)n;
+	}
+	return true;
+}
+
+struct Config {
+	bool verbose;
+	const char* filename;
+	size_t max_cells_limit;
+	uint64_t fuel;
+};
+
+void print_usage(const char* prog_name)
+{
+	printf("Usage: %s [options] <file>\n", prog_name);
+	printf("  -h, --help           Show help\n");
+	printf("  -v, --verbose        Verbose output\n");
+	printf("  -m, --max <cells>    Set max tape length limit (30000 cells "
+	       "default)\n");
+	printf("  -f, --fuel <n>       Stop the program after about <n> ops "
+	       "(unlimited default)\n");
+}
+
+int main(int argc, char* argv[])
+{
+	struct Config config = {.verbose	 = false,
+				.filename	 = nullptr,
+				.max_cells_limit = 30000,
+				.fuel		 = BF_FUEL_UNLIMITED};
+
+	static const struct option long_options[] = {
+		{"help", no_argument, 0, 'h'},
+		{"verbose", no_argument, 0, 'v'},
+		{"max", required_argument, 0, 'm'},
+		{"fuel", required_argument, 0, 'f'},
+		{0}};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "hvm:f:", long_options,
+				  nullptr)) != -1) {
+		switch (opt) {
+		case 'h':
+			print_usage(argv[0]);
+			return 0;
+		case 'v':
+			config.verbose = true;
+			break;
+		case 'm': {
+			char* endptr;
+			unsigned long long limit =
+				strtoull(optarg, &endptr, 10);
+			if (*endptr != '\0' || limit == 0)
+				return EXIT_FAILURE;
+			config.max_cells_limit = (size_t)limit;
+			break;
+		}
+		case 'f': {
+			char* endptr;
+			unsigned long long fuel = strtoull(optarg, &endptr, 10);
+			if (*endptr != '\0' || fuel == 0)
+				return EXIT_FAILURE;
+			config.fuel = (uint64_t)fuel;
+			break;
+		}
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind < argc) {
+		config.filename = argv[optind];
+	} else {
+		fprintf(stderr, "Error: No input file.\n");
+		print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	struct Source source;
+	if (!source_load(&source, config.filename)) {
+		perror("Failed to read file");
+		return EXIT_FAILURE;
+	}
+
+	if (config.verbose)
+		printf("Compiling...\n");
+
+	struct BfProgram* program;
+	enum BfStatus status = bf_compile(source.data, source.size,
+					  config.max_cells_limit, &program);
+	source_free(&source);
+	if (status != BfStatus_OK) {
+		fprintf(stderr, "Error: %s\n", bf_status_message(status));
+		fprintf(stderr, "Compilation Failed.\n");
+		return EXIT_FAILURE;
+	}
+
+	struct BfContext* ctx = bf_context_new(program);
+	if (!ctx) {
+		fprintf(stderr, "Failed to initialize tape.\n");
+		bf_program_free(program);
+		return EXIT_FAILURE;
+	}
+	bf_set_fuel(ctx, config.fuel);
+
+	if (config.verbose)
+		printf("Running...\n");
+	fflush(stdout);
+
+	static const struct BfIo io = {.read  = stdin_read,
+				       .write = stdout_write};
+	status = bf_run(ctx, &io);
+	if (status != BfStatus_OK)
+		fprintf(stderr, "Error: %s.\n", bf_status_message(status));
+
+	if (config.verbose && config.fuel != BF_FUEL_UNLIMITED)
+		printf("Fuel used: %llu of %llu\n",
+		       (unsigned long long)(config.fuel - bf_fuel(ctx)),
+		       (unsigned long long)config.fuel);
+
+	bf_context_free(ctx);
+	bf_program_free(program);
+	return status == BfStatus_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,629 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bf.h"
+#include "source.h"
+
+/*
+ * bfsched: many programs at once on few threads.  Every job is a libbf
+ * context that runs for one slice of fuel and is then put back in line, so
+ * thousands of jobs share a core without a thread, a stack or a kernel
+ * context switch each.  With one thread the jobs simply take turns; with
+ * more, each worker keeps its own line of jobs and steals from the others
+ * once it runs dry.
+ */
+
+#define JOB_OUTPUT_SIZE 4096
+
+/*
+ * One running program.  Input is read straight from the shared --input
+ * buffer; output collects in `out` and is appended to the job's file when
+ * it fills up and when the job ends.  The file is only open while being
+ * written, so the number of jobs is not bounded by the descriptor limit.
+ */
+struct Job {
+	const char* name;
+	size_t instance;
+	struct BfContext* ctx;
+
+	size_t in_pos;
+	uint64_t budget;
+
+	char path[PATH_MAX];
+	bool created;
+	size_t out_size;
+	uint8_t out[JOB_OUTPUT_SIZE];
+};
+
+#define SCHED_MAX_THREADS 256
+#define SCHED_STEAL_MAX	  64
+
+struct SchedWorker {
+	struct Sched* sched;
+	size_t id;
+	pthread_t thread;
+
+	/* Runnable jobs, a ring of `count` starting at `head`. */
+	pthread_mutex_t lock;
+	struct Job** ring;
+	size_t head;
+	size_t count;
+
+	size_t failed;
+	uint64_t slices;
+	size_t stolen;
+};
+
+struct Sched {
+	const uint8_t* input;
+	size_t input_size;
+	uint64_t slice;
+
+	struct Job* jobs;
+	size_t job_count;
+
+	/* Jobs not finished yet; workers stop once it reaches 0. */
+	size_t live;
+
+	struct SchedWorker* workers;
+	size_t worker_count;
+
+	/*
+	 * Workers with nothing to run or steal sleep on `idle` until a slice
+	 * puts a job back in line or a job ends.  `wakeups` counts those
+	 * events, so one that comes between a failed steal and the wait is
+	 * not lost; `sleeping` lets the busy path skip the lock when nobody
+	 * is waiting.
+	 */
+	pthread_mutex_t idle_lock;
+	pthread_cond_t idle;
+	uint64_t wakeups;
+	size_t sleeping;
+};
+
+/*
+ * Errors name the job; stderr is locked so workers' lines don't mix.  A
+ * nonzero `err` is the errno behind `what`.
+ */
+static void job_report(const struct Job* self, const char* what, int err)
+{
+	flockfile(stderr);
+	fprintf(stderr, "%s", self->name);
+	if (self->instance != SIZE_MAX)
+		fprintf(stderr, "#%zu", self->instance);
+	if (err)
+		fprintf(stderr, ": Error: %s: %s\n", what, strerror(err));
+	else
+		fprintf(stderr, ": Error: %s.\n", what);
+	funlockfile(stderr);
+}
+
+/* Appends the buffered output to the job's file, creating it the first time. */
+bool job_flush(struct Job* self)
+{
+	if (self->out_size == 0 && self->created)
+		return true;
+
+	int flags = O_WRONLY | O_CREAT | (self->created ? O_APPEND : O_TRUNC);
+	int fd	  = open(self->path, flags, 0644);
+	if (fd < 0)
+		return false;
+	self->created = true;
+
+	const uint8_t* data = self->out;
+	size_t size	    = self->out_size;
+	while (size > 0) {
+		ssize_t n = write(fd, data, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		data += n;
+		size -= (size_t)n;
+	}
+	self->out_size = 0;
+	return close(fd) == 0 && size == 0;
+}
+
+/*
+ * Runs one slice of `job`.  Returns true while the job still has work
+ * left; otherwise it has been flushed, reported and its context freed,
+ * and `*failed` says whether it ended in error.
+ */
+bool job_slice(struct Job* self, const struct Sched* sched, bool* failed)
+{
+	uint64_t slice = sched->slice < self->budget ? sched->slice
+						      : self->budget;
+	bf_set_fuel(self->ctx, slice);
+
+	enum BfStatus status;
+	for (;;) {
+		size_t used, written;
+		status = bf_resume(self->ctx, sched->input + self->in_pos,
+				   sched->input_size - self->in_pos, &used,
+				   self->out + self->out_size,
+				   JOB_OUTPUT_SIZE - self->out_size, &written);
+		self->in_pos += used;
+		self->out_size += written;
+		if (status != BfStatus_OUTPUT_FULL)
+			break;
+		if (!job_flush(self)) {
+			status = BfStatus_IO_ERROR;
+			break;
+		}
+	}
+
+	if (self->budget != BF_FUEL_UNLIMITED)
+		self->budget -= slice - bf_fuel(self->ctx);
+	if (status == BfStatus_OUT_OF_FUEL && self->budget > 0)
+		return true;
+
+	bool ok	  = status == BfStatus_OK;
+	bool sent = job_flush(self);
+	if (!ok)
+		job_report(self, bf_status_message(status), 0);
+	else if (!sent)
+		job_report(self, "Failed to write output", errno);
+
+	bf_context_free(self->ctx);
+	self->ctx = nullptr;
+	*failed	  = !ok || !sent;
+	return false;
+}
+
+/* Callers hold the worker's lock. */
+static void sched_push(struct SchedWorker* self, struct Job* job)
+{
+	size_t cap = self->sched->job_count;
+	self->ring[(self->head + self->count) % cap] = job;
+	self->count++;
+}
+
+/*
+ * Takes the job at the front of this worker's line.  When the line is
+ * empty it steals the back half of another worker's, up to
+ * SCHED_STEAL_MAX, and starts on the first of them.
+ */
+struct Job* sched_next(struct SchedWorker* self)
+{
+	struct Sched* sched = self->sched;
+	size_t cap	    = sched->job_count;
+	struct Job* job	    = nullptr;
+
+	pthread_mutex_lock(&self->lock);
+	if (self->count > 0) {
+		job	   = self->ring[self->head];
+		self->head = (self->head + 1) % cap;
+		self->count--;
+	}
+	pthread_mutex_unlock(&self->lock);
+	if (job)
+		return job;
+
+	struct Job* loot[SCHED_STEAL_MAX];
+	for (size_t k = 1; k < sched->worker_count; ++k) {
+		struct SchedWorker* victim =
+			&sched->workers[(self->id + k) % sched->worker_count];
+
+		pthread_mutex_lock(&victim->lock);
+		size_t take = (victim->count + 1) / 2;
+		if (take > SCHED_STEAL_MAX)
+			take = SCHED_STEAL_MAX;
+		victim->count -= take;
+		for (size_t j = 0; j < take; ++j)
+			loot[j] = victim->ring[(victim->head + victim->count +
+						j) % cap];
+		pthread_mutex_unlock(&victim->lock);
+
+		if (take == 0)
+			continue;
+
+		pthread_mutex_lock(&self->lock);
+		for (size_t j = 1; j < take; ++j)
+			sched_push(self, loot[j]);
+		pthread_mutex_unlock(&self->lock);
+		self->stolen += take;
+		return loot[0];
+	}
+	return nullptr;
+}
+
+/*
+ * Tells idle workers there may be something for them.  The counters are
+ * sequentially consistent so that either the waker sees a sleeper or the
+ * sleeper sees the new count (or `live` at 0) before it waits.
+ */
+static void sched_wake(struct Sched* self)
+{
+	__atomic_fetch_add(&self->wakeups, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&self->sleeping, __ATOMIC_SEQ_CST) == 0)
+		return;
+	pthread_mutex_lock(&self->idle_lock);
+	pthread_cond_broadcast(&self->idle);
+	pthread_mutex_unlock(&self->idle_lock);
+}
+
+/* Sleeps until a sched_wake after `seen`, or until every job is done. */
+static void sched_idle(struct Sched* self, uint64_t seen)
+{
+	pthread_mutex_lock(&self->idle_lock);
+	__atomic_fetch_add(&self->sleeping, 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&self->wakeups, __ATOMIC_SEQ_CST) == seen &&
+	       __atomic_load_n(&self->live, __ATOMIC_SEQ_CST) > 0)
+		pthread_cond_wait(&self->idle, &self->idle_lock);
+	__atomic_fetch_sub(&self->sleeping, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&self->idle_lock);
+}
+
+void* sched_worker(void* arg)
+{
+	struct SchedWorker* self = arg;
+	struct Sched* sched	 = self->sched;
+
+	while (__atomic_load_n(&sched->live, __ATOMIC_ACQUIRE) > 0) {
+		uint64_t seen = __atomic_load_n(&sched->wakeups,
+						__ATOMIC_SEQ_CST);
+		struct Job* job = sched_next(self);
+		if (!job) {
+			/* Whatever is left is mid-slice on other workers. */
+			sched_idle(sched, seen);
+			continue;
+		}
+
+		bool failed = false;
+		self->slices++;
+		if (job_slice(job, sched, &failed)) {
+			pthread_mutex_lock(&self->lock);
+			sched_push(self, job);
+			pthread_mutex_unlock(&self->lock);
+			sched_wake(sched);
+			continue;
+		}
+		if (failed)
+			self->failed++;
+		__atomic_fetch_sub(&sched->live, 1, __ATOMIC_SEQ_CST);
+		sched_wake(sched);
+	}
+	return nullptr;
+}
+
+/*
+ * Deals the jobs out round-robin and runs them to the end.  Returns how
+ * many failed, or SIZE_MAX if the workers could not be set up.
+ */
+size_t sched_run(struct Sched* self, size_t threads)
+{
+	if (threads > self->job_count)
+		threads = self->job_count;
+	if (threads > SCHED_MAX_THREADS)
+		threads = SCHED_MAX_THREADS;
+	if (threads == 0)
+		return 0;
+
+	self->workers = calloc(threads, sizeof(struct SchedWorker));
+	if (!self->workers)
+		return SIZE_MAX;
+	if (pthread_mutex_init(&self->idle_lock, nullptr) != 0)
+		return SIZE_MAX;
+	if (pthread_cond_init(&self->idle, nullptr) != 0) {
+		pthread_mutex_destroy(&self->idle_lock);
+		return SIZE_MAX;
+	}
+	self->worker_count = threads;
+	self->live	   = self->job_count;
+	self->wakeups	   = 0;
+	self->sleeping	   = 0;
+
+	size_t failed = 0;
+	size_t ready  = 0;
+	for (; ready < threads; ++ready) {
+		struct SchedWorker* worker = &self->workers[ready];
+		worker->sched		   = self;
+		worker->id		   = ready;
+		worker->ring = calloc(self->job_count, sizeof(struct Job*));
+		if (!worker->ring ||
+		    pthread_mutex_init(&worker->lock, nullptr) != 0) {
+			free(worker->ring);
+			failed = SIZE_MAX;
+			break;
+		}
+	}
+
+	/* Worker 0 runs on this thread. */
+	size_t started = 1;
+	if (failed == 0) {
+		for (size_t k = 0; k < self->job_count; ++k)
+			sched_push(&self->workers[k % threads],
+				   &self->jobs[k]);
+		for (; started < threads; ++started) {
+			struct SchedWorker* worker = &self->workers[started];
+			if (pthread_create(&worker->thread, nullptr,
+					   sched_worker, worker) != 0)
+				break;
+		}
+		/* The lines of workers that failed to start get stolen. */
+		sched_worker(&self->workers[0]);
+		for (size_t k = 1; k < started; ++k)
+			pthread_join(self->workers[k].thread, nullptr);
+	}
+
+	for (size_t k = 0; k < ready; ++k) {
+		struct SchedWorker* worker = &self->workers[k];
+		if (failed != SIZE_MAX)
+			failed += worker->failed;
+		pthread_mutex_destroy(&worker->lock);
+		free(worker->ring);
+	}
+	pthread_cond_destroy(&self->idle);
+	pthread_mutex_destroy(&self->idle_lock);
+	return failed;
+}
+
+void sched_free(struct Sched* self)
+{
+	for (size_t k = 0; k < self->job_count; ++k)
+		bf_context_free(self->jobs[k].ctx);
+	free(self->jobs);
+	free(self->workers);
+	self->jobs	   = nullptr;
+	self->job_count	   = 0;
+	self->workers	   = nullptr;
+	self->worker_count = 0;
+}
+
+struct Config {
+	bool verbose;
+	size_t max_cells_limit;
+	size_t instances;
+	const char* input;
+	const char* out_dir;
+	uint64_t slice;
+	uint64_t fuel;
+	size_t threads;
+};
+
+void print_usage(const char* prog_name)
+{
+	printf("Usage: %s [options] <file>...\n", prog_name);
+	printf("  -h, --help           Show help\n");
+	printf("  -v, --verbose        Verbose output\n");
+	printf("  -m, --max <cells>    Set max tape length limit (30000 cells "
+	       "default)\n");
+	printf("  -n, --instances <n>  Run <n> instances of every program "
+	       "(1 default)\n");
+	printf("  -i, --input <file>   Input given to every job (none "
+	       "default)\n");
+	printf("  -o, --out-dir <dir>  Write outputs to <dir> instead of "
+	       "next to each\n"
+	       "                       program\n");
+	printf("  -s, --slice <n>      Fuel per turn before the next job runs "
+	       "(65536 default)\n");
+	printf("  -f, --fuel <n>       Stop each job after about <n> ops "
+	       "(unlimited default)\n");
+	printf("  -t, --threads <n>    Worker threads, which steal jobs from "
+	       "each other\n"
+	       "                       (1 default)\n");
+}
+
+/*
+ * "<program>.out", or "<program>.<k>.out" for the k-th of several
+ * instances; under --out-dir, the program's file name goes there instead.
+ */
+bool job_output_path(const struct Config* config, const char* program,
+		     size_t instance, char* path, size_t size)
+{
+	const char* base = program;
+	if (config->out_dir) {
+		const char* name = strrchr(program, '/');
+		base		 = name ? name + 1 : program;
+	}
+	const char* dir = config->out_dir ? config->out_dir : "";
+	const char* sep = config->out_dir ? "/" : "";
+
+	int n;
+	if (instance == SIZE_MAX)
+		n = snprintf(path, size, "%s%s%s.out", dir, sep, base);
+	else
+		n = snprintf(path, size, "%s%s%s.%zu.out", dir, sep, base,
+			     instance);
+	return n > 0 && (size_t)n < size;
+}
+
+/*
+ * Compiles every program once and sets up its instances as jobs, all
+ * sharing the one BfProgram.  Prints what went wrong and returns false on
+ * failure.
+ */
+bool sched_load(struct Sched* self, const struct Config* config,
+		char** programs, size_t program_count,
+		struct BfProgram** compiled)
+{
+	self->job_count = program_count * config->instances;
+	self->jobs	= calloc(self->job_count, sizeof(struct Job));
+	if (!self->jobs) {
+		fprintf(stderr, "Failed to allocate jobs.\n");
+		return false;
+	}
+
+	for (size_t p = 0; p < program_count; ++p) {
+		struct Source source;
+		if (!source_load(&source, programs[p])) {
+			fprintf(stderr, "%s: ", programs[p]);
+			perror("Failed to read file");
+			return false;
+		}
+		enum BfStatus status =
+			bf_compile(source.data, source.size,
+				   config->max_cells_limit, &compiled[p]);
+		source_free(&source);
+		if (status != BfStatus_OK) {
+			fprintf(stderr, "%s: Error: %s\n", programs[p],
+				bf_status_message(status));
+			fprintf(stderr, "Compilation Failed.\n");
+			return false;
+		}
+
+		size_t n = config->instances;
+		for (size_t k = 0; k < n; ++k) {
+			struct Job* job = &self->jobs[p * n + k];
+			job->name	= programs[p];
+			job->instance	= n > 1 ? k : SIZE_MAX;
+			job->budget	= config->fuel;
+			if (!job_output_path(config, programs[p], job->instance,
+					     job->path, sizeof(job->path))) {
+				fprintf(stderr,
+					"%s: Error: Output path too long.\n",
+					programs[p]);
+				return false;
+			}
+			job->ctx = bf_context_new(compiled[p]);
+			if (!job->ctx) {
+				fprintf(stderr, "Failed to initialize tape.\n");
+				return false;
+			}
+			/* Everything there is to read is there already. */
+			bf_end_input(job->ctx);
+		}
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	struct Config config = {.verbose	 = false,
+				.max_cells_limit = 30000,
+				.instances	 = 1,
+				.slice		 = 65536,
+				.fuel		 = BF_FUEL_UNLIMITED,
+				.threads	 = 1};
+
+	static const struct option long_options[] = {
+		{"help", no_argument, 0, 'h'},
+		{"verbose", no_argument, 0, 'v'},
+		{"max", required_argument, 0, 'm'},
+		{"instances", required_argument, 0, 'n'},
+		{"input", required_argument, 0, 'i'},
+		{"out-dir", required_argument, 0, 'o'},
+		{"slice", required_argument, 0, 's'},
+		{"fuel", required_argument, 0, 'f'},
+		{"threads", required_argument, 0, 't'},
+		{0}};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "hvm:n:i:o:s:f:t:",
+				  long_options, nullptr)) != -1) {
+		switch (opt) {
+		case 'h':
+			print_usage(argv[0]);
+			return 0;
+		case 'v':
+			config.verbose = true;
+			break;
+		case 'i':
+			config.input = optarg;
+			break;
+		case 'o':
+			config.out_dir = optarg;
+			break;
+		case 'm':
+		case 'n':
+		case 's':
+		case 'f':
+		case 't': {
+			char* endptr;
+			unsigned long long value =
+				strtoull(optarg, &endptr, 10);
+			if (*endptr != '\0' || value == 0)
+				return EXIT_FAILURE;
+			if (opt == 'm')
+				config.max_cells_limit = (size_t)value;
+			else if (opt == 'n')
+				config.instances = (size_t)value;
+			else if (opt == 's')
+				config.slice = (uint64_t)value;
+			else if (opt == 'f')
+				config.fuel = (uint64_t)value;
+			else
+				config.threads = (size_t)value;
+			break;
+		}
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind >= argc) {
+		fprintf(stderr, "Error: No input file.\n");
+		print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	char** programs	     = argv + optind;
+	size_t program_count = (size_t)(argc - optind);
+	if (config.instances > SIZE_MAX / program_count) {
+		fprintf(stderr, "Error: Too many instances.\n");
+		return EXIT_FAILURE;
+	}
+
+	struct Source input = {0};
+	if (config.input && !source_load(&input, config.input)) {
+		perror("Failed to read input");
+		return EXIT_FAILURE;
+	}
+
+	struct BfProgram** compiled =
+		calloc(program_count, sizeof(struct BfProgram*));
+	struct Sched sched = {.input	  = (const uint8_t*)input.data,
+			      .input_size = input.size,
+			      .slice	  = config.slice};
+
+	if (config.verbose)
+		printf("Compiling...\n");
+
+	size_t failed = SIZE_MAX;
+	if (!compiled) {
+		fprintf(stderr, "Failed to allocate programs.\n");
+	} else if (sched_load(&sched, &config, programs, program_count,
+			      compiled)) {
+		if (config.verbose)
+			printf("Running %zu jobs...\n", sched.job_count);
+		fflush(stdout);
+
+		failed = sched_run(&sched, config.threads);
+		if (failed == SIZE_MAX)
+			fprintf(stderr, "Failed to start workers.\n");
+	}
+
+	if (config.verbose && failed != SIZE_MAX) {
+		uint64_t slices = 0;
+		size_t stolen	= 0;
+		for (size_t k = 0; k < sched.worker_count; ++k) {
+			slices += sched.workers[k].slices;
+			stolen += sched.workers[k].stolen;
+		}
+		printf("Scheduled: %zu jobs on %zu threads, %zu failed, "
+		       "%llu slices, %zu stolen\n",
+		       sched.job_count, sched.worker_count, failed,
+		       (unsigned long long)slices, stolen);
+	}
+
+	sched_free(&sched);
+	for (size_t p = 0; compiled && p < program_count; ++p)
+		bf_program_free(compiled[p]);
+	free(compiled);
+	if (config.input)
+		source_free(&input);
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,14 +1,41 @@
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define TAPE_SIZE 30000
+#define OUTPUT_BUFFER_SIZE 65536
 
-void brainfuck(const char* code) {
+// 输出先攒在缓冲区里，满了、读输入之前和程序结束时再一次性 write
+static unsigned char output_buffer[OUTPUT_BUFFER_SIZE];
+static size_t output_size = 0;
+
+static void flush_output(void) {
+    size_t done = 0;
+    while (done < output_size) {
+        ssize_t n = write(STDOUT_FILENO, output_buffer + done, output_size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    output_size = 0;
+}
+
+static void put_output(unsigned char c) {
+    output_buffer[output_size++] = c;
+    if (output_size == OUTPUT_BUFFER_SIZE) flush_output();
+}
+
+void brainfuck(const char* code, size_t length) {
     unsigned char tape[TAPE_SIZE] = {0};
     int ptr = 0;
 
     // 使用 int 而不是 unsigned char，防止某些极端情况下的溢出
-    for (int i = 0; code[i] != '\0'; i++) {
+    for (int i = 0; (size_t)i < length; i++) {
         switch (code[i]) {
             case '>':
                 ptr++;
@@ -31,9 +58,10 @@ void brainfuck(const char* code) {
                 tape[ptr]--;
                 break;
             case '.':
-                putchar(tape[ptr]);
+                put_output(tape[ptr]);
                 break;
             case ',': {
+                flush_output();
                 int c = getchar();
                 if (c != EOF) {
                     tape[ptr] = (unsigned char)c;
@@ -48,7 +76,7 @@ void brainfuck(const char* code) {
                     while (depth > 0) {
                         i++;
                         // 安全检查：如果代码结束了还没找到匹配的 ]
-                        if (code[i] == '\0') {
+                        if ((size_t)i >= length) {
                             fprintf(stderr, "Error: Unmatched '[' at index %d\n", i);
                             return;
                         }
@@ -79,21 +107,41 @@ void brainfuck(const char* code) {
     }
 }
 
-// 辅助函数：读取文件内容
-char* read_file(const char* filename) {
-    FILE* f = fopen(filename, "rb");
-    if (!f) return NULL;
-    
-    fseek(f, 0, SEEK_END);
-    long length = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    
-    char* buffer = malloc(length + 1);
-    if (buffer) {
-        fread(buffer, 1, length, f);
-        buffer[length] = '\0';
+// 辅助函数：读取文件内容，长度通过 length 返回，内容不以 '\0' 结尾
+// 普通文件直接 mmap，不拷贝；管道和 "-"（标准输入）没法 mmap，就整段读进缓冲区
+// *mapped 告诉调用者最后该用 munmap 还是 free
+char* read_file(const char* filename, size_t* length, int* mapped) {
+    int fd = strcmp(filename, "-") == 0 ? STDIN_FILENO : open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        char* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            if (fd != STDIN_FILENO) close(fd);
+            *length = (size_t)st.st_size;
+            *mapped = 1;
+            return map;
+        }
+    }
+
+    size_t size = 0, capacity = 65536;
+    char* buffer = malloc(capacity);
+    while (buffer) {
+        if (size == capacity) {
+            char* grown = realloc(buffer, capacity *= 2);
+            if (!grown) { free(buffer); buffer = NULL; break; }
+            buffer = grown;
+        }
+        ssize_t n = read(fd, buffer + size, capacity - size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) { free(buffer); buffer = NULL; break; }
+        if (n == 0) break;
+        size += (size_t)n;
     }
-    fclose(f);
+    if (fd != STDIN_FILENO) close(fd);
+    *length = size;
+    *mapped = 0;
     return buffer;
 }
 
@@ -103,14 +151,18 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    char* code = read_file(argv[1]);
+    size_t length;
+    int mapped;
+    char* code = read_file(argv[1], &length, &mapped);
     if (!code) {
         fprintf(stderr, "Error: Could not read file %s\n", argv[1]);
         return 1;
     }
 
-    brainfuck(code);
+    brainfuck(code, length);
+    flush_output();
     
-    free(code);
+    if (mapped) munmap(code, length);
+    else free(code);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,995 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "frontend.h"
+#include "source.h"
+#include "tape.h"
+
+/*
+ * Lanes hold one cell of every instance in a group, one byte each: 32 of
+ * them fill an AVX2 register, 16 an SSE2 one.  Arithmetic on them is plain
+ * vector arithmetic; only turning a row into a per-lane zero mask needs
+ * the instruction set spelled out.
+ */
+#if defined(__AVX2__)
+#define SPMD_LANES 32
+#else
+#define SPMD_LANES 16
+#endif
+
+typedef uint8_t Lanes __attribute__((vector_size(SPMD_LANES)));
+
+static inline Lanes lanes_load(const uint8_t* row)
+{
+	Lanes v;
+	memcpy(&v, row, sizeof(v));
+	return v;
+}
+
+static inline void lanes_store(uint8_t* row, Lanes v)
+{
+	memcpy(row, &v, sizeof(v));
+}
+
+static inline Lanes lanes_splat(uint8_t value)
+{
+	return (Lanes){0} + value;
+}
+
+/* Bit k is set when lane k's byte of the row is zero. */
+static inline uint32_t lanes_zero_mask(const uint8_t* row)
+{
+#if defined(__AVX2__)
+	__m256i v = _mm256_loadu_si256((const __m256i*)row);
+	return (uint32_t)_mm256_movemask_epi8(
+		_mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+#elif defined(__SSE2__)
+	__m128i v = _mm_loadu_si128((const __m128i*)row);
+	return (uint32_t)_mm_movemask_epi8(
+		_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+#else
+	uint32_t mask = 0;
+	for (int k = 0; k < SPMD_LANES; ++k)
+		mask |= (uint32_t)(row[k] == 0) << k;
+	return mask;
+#endif
+}
+
+/*
+ * One instance of the program.  While it runs in its group the lane is
+ * just its I/O; once it splits off it also gets a tape of its own, `cells`
+ * pointing at cell 0 of it, and the op and head position to resume at.
+ */
+struct Lane {
+	const char* name;
+	struct Source source;
+	struct Input in;
+	struct Output out;
+
+	uint8_t* tape;
+	uint8_t* cells;
+	long ptr;
+	size_t pc;
+
+	enum TapFault fault;
+};
+
+/*
+ * Up to SPMD_LANES instances of one program run in lockstep, lane k of the
+ * group being byte k of every row: row `at` of the tape holds cell `at` of
+ * each instance side by side, so every op is one vector operation on one
+ * row.  Instances that have run the same ops have moved the head the same
+ * way, so the group shares one head and one pc.  When a jump or a scan
+ * comes out differently across lanes, the smaller side splits off (see
+ * group_diverge) and the rest carry on together.
+ *
+ * Cells [-left, limit) of every lane exist, `left` being limit rounded out
+ * the way the other engines' tapes round it to a page.  The rows are mapped
+ * up front and paged in on first touch.  Accesses are bounds checked, as
+ * the head is a row index rather than a pointer into a guarded reservation.
+ */
+struct Group {
+	uint8_t* map;
+	size_t map_size;
+	uint8_t* rows;
+	long left;
+	long limit;
+	long reach;
+
+	/* The lowest and highest head position so far this run. */
+	long lo;
+	long hi;
+
+	uint32_t active;
+	uint32_t split;
+	struct Lane lanes[SPMD_LANES];
+};
+
+#define ROW(rows, at) ((rows) + (at) * SPMD_LANES)
+
+static inline uint32_t lanes_all(size_t count)
+{
+	return count ? UINT32_MAX >> (32 - count) : 0;
+}
+
+bool group_init(struct Group* self, size_t limit, size_t reach)
+{
+	size_t page    = (size_t)sysconf(_SC_PAGESIZE);
+	size_t cells   = (2 * limit + page - 1) & ~(page - 1);
+	self->left     = (long)(cells - limit);
+	self->limit    = (long)limit;
+	self->reach    = (long)reach;
+	self->lo       = 0;
+	self->hi       = 0;
+	self->map_size = cells * SPMD_LANES;
+	self->map      = mmap(nullptr, self->map_size, PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1,
+			      0);
+	if (self->map == MAP_FAILED) {
+		self->map = nullptr;
+		return false;
+	}
+	self->rows = ROW(self->map, self->left);
+	return true;
+}
+
+void group_deinit(struct Group* self)
+{
+	if (self->map)
+		munmap(self->map, self->map_size);
+	self->map = nullptr;
+}
+
+/* The rows a run can have touched: its head positions give or take reach. */
+static void group_touched(const struct Group* self, long* lo, long* hi)
+{
+	*lo = self->lo - self->reach;
+	*hi = self->hi + self->reach;
+	if (*lo < -self->left)
+		*lo = -self->left;
+	if (*hi > self->limit - 1)
+		*hi = self->limit - 1;
+}
+
+/* Zeroes the tape for the next group of inputs. */
+void group_reset(struct Group* self)
+{
+	long lo, hi;
+	group_touched(self, &lo, &hi);
+
+	size_t page    = (size_t)sysconf(_SC_PAGESIZE);
+	uintptr_t from = (uintptr_t)ROW(self->rows, lo);
+	uintptr_t to   = (uintptr_t)ROW(self->rows, hi + 1);
+	from &= ~(uintptr_t)(page - 1);
+	madvise((void*)from, to - from, MADV_DONTNEED);
+
+	self->lo = 0;
+	self->hi = 0;
+}
+
+/* Copies lane k's column of the tape out and parks it at `pc`. */
+bool lane_split(struct Lane* self, const struct Group* group, size_t k,
+		size_t pc, long ptr)
+{
+	self->tape = calloc((size_t)(group->left + group->limit), 1);
+	if (!self->tape)
+		return false;
+	self->cells = self->tape + group->left;
+
+	long lo, hi;
+	group_touched(group, &lo, &hi);
+	for (long at = lo; at <= hi; ++at)
+		self->cells[at] = ROW(group->rows, at)[k];
+
+	self->ptr = ptr;
+	self->pc  = pc;
+	return true;
+}
+
+/*
+ * The lanes in `active` disagree at op `pc`: those in `taken` go one way
+ * and the rest the other.  Whichever side has fewer lanes leaves the group
+ * with the head and pc as they were before the op, and reruns it alone;
+ * the other side's lanes are returned as the group's new active set.
+ */
+uint32_t group_diverge(struct Group* self, uint32_t active, uint32_t taken,
+		       size_t pc, long ptr)
+{
+	uint32_t rest = active & ~taken;
+	uint32_t stay = __builtin_popcount(taken) >= __builtin_popcount(rest)
+				? taken
+				: rest;
+
+	for (uint32_t m = active & ~stay; m; m &= m - 1) {
+		size_t k	  = (size_t)__builtin_ctz(m);
+		struct Lane* lane = &self->lanes[k];
+		if (!lane_split(lane, self, k, pc, ptr))
+			lane->fault = TapFault_MEMORY;
+		self->split |= 1u << k;
+	}
+	return stay;
+}
+
+/*
+ * Runs the group's active lanes in lockstep until they halt or fault.  On
+ * return `active` holds the lanes that finished in the group, and `split`
+ * the ones that left it and still have to be finished by lane_exec.
+ */
+void group_exec(struct Group* self, const struct Program* prog)
+{
+	const struct Instruction* ops = prog->ops;
+	uint8_t* rows		      = self->rows;
+	long left		      = self->left;
+	long limit		      = self->limit;
+	uint32_t active		      = self->active;
+	struct Lane* lanes	      = self->lanes;
+
+	size_t pc = 0;
+	long ptr  = 0;
+	long at	  = 0;
+
+#define CELL(offset)                                 \
+	({                                           \
+		at = ptr + (offset);                 \
+		if (at < -left || at >= limit)       \
+			goto fault;                  \
+		ROW(rows, at);                       \
+	})
+
+	for (;;) {
+		const struct Instruction* instr = &ops[pc];
+
+		switch (instr->type) {
+		case OperationType_INC_PTR:
+			ptr += (long)instr->operand;
+			if (ptr > self->hi)
+				self->hi = ptr;
+			break;
+
+		case OperationType_DEC_PTR:
+			ptr -= (long)instr->operand;
+			if (ptr < self->lo)
+				self->lo = ptr;
+			break;
+
+		case OperationType_ADD_VAL: {
+			uint8_t* row  = CELL(instr->offset);
+			uint8_t value = (uint8_t)instr->operand;
+			lanes_store(row, lanes_load(row) + value);
+			break;
+		}
+
+		case OperationType_SUB_VAL: {
+			uint8_t* row  = CELL(instr->offset);
+			uint8_t value = (uint8_t)instr->operand;
+			lanes_store(row, lanes_load(row) - value);
+			break;
+		}
+
+		case OperationType_SET_VAL:
+			lanes_store(CELL(instr->offset),
+				    lanes_splat((uint8_t)instr->operand));
+			break;
+
+		case OperationType_MUL_ADD: {
+			Lanes value    = lanes_load(CELL(0));
+			uint8_t* row   = CELL(instr->offset);
+			uint8_t factor = (uint8_t)instr->operand;
+			lanes_store(row, lanes_load(row) + value * factor);
+			break;
+		}
+
+		case OperationType_OUTPUT: {
+			const uint8_t* row = CELL(instr->offset);
+			for (uint32_t m = active; m; m &= m - 1) {
+				int k = __builtin_ctz(m);
+				output_put(&lanes[k].out, row[k]);
+			}
+			break;
+		}
+
+		case OperationType_INPUT: {
+			uint8_t* row = CELL(instr->offset);
+			for (uint32_t m = active; m; m &= m - 1) {
+				int k = __builtin_ctz(m);
+				int c = input_get(&lanes[k].in, &lanes[k].out);
+				if (c != EOF)
+					row[k] = (uint8_t)c;
+			}
+			break;
+		}
+
+		case OperationType_JUMP_ZERO:
+		case OperationType_JUMP_NONZERO: {
+			uint32_t zero  = lanes_zero_mask(CELL(0)) & active;
+			uint32_t taken = instr->type == OperationType_JUMP_ZERO
+						 ? zero
+						 : active & ~zero;
+			if (taken != 0 && taken != active)
+				active = group_diverge(self, active, taken, pc,
+						       ptr);
+			if (active & taken) {
+				pc = instr->operand + 1;
+				continue;
+			}
+			break;
+		}
+
+		/*
+		 * Every lane steps along until its cell is zero; lanes that
+		 * stop at different distances diverge.  Running off the
+		 * tape faults every lane still scanning.
+		 */
+		case OperationType_SCAN_RIGHT:
+		case OperationType_SCAN_LEFT: {
+			long step = instr->type == OperationType_SCAN_RIGHT
+					    ? (long)instr->operand
+					    : -(long)instr->operand;
+			long dist = 0;
+			for (;;) {
+				uint32_t zero =
+					lanes_zero_mask(CELL(dist)) & active;
+				if (zero == active)
+					break;
+				if (zero != 0) {
+					active = group_diverge(self, active,
+							       zero, pc, ptr);
+					if (active == zero)
+						break;
+				}
+				dist += step;
+			}
+			ptr += dist;
+			if (ptr > self->hi)
+				self->hi = ptr;
+			if (ptr < self->lo)
+				self->lo = ptr;
+			break;
+		}
+
+		case OperationType_WRITE_LITERAL:
+			for (uint32_t m = active; m; m &= m - 1) {
+				int k = __builtin_ctz(m);
+				output_write(&lanes[k].out,
+					     prog->data + instr->offset,
+					     instr->operand);
+			}
+			break;
+
+		case OperationType_HALT:
+			self->active = active;
+			return;
+		}
+		pc++;
+	}
+
+#undef CELL
+
+fault:
+	for (uint32_t m = active; m; m &= m - 1)
+		lanes[__builtin_ctz(m)].fault =
+			at >= limit ? TapFault_RIGHT : TapFault_LEFT;
+	self->active = active;
+}
+
+/* Finishes a lane that split off from its group, on its own tape. */
+void lane_exec(struct Lane* self, const struct Program* prog, long left,
+	       long limit)
+{
+	const struct Instruction* ops = prog->ops;
+	uint8_t* cells		      = self->cells;
+
+	size_t pc = self->pc;
+	long ptr  = self->ptr;
+	long at	  = 0;
+
+#define CELL(offset)                                 \
+	({                                           \
+		at = ptr + (offset);                 \
+		if (at < -left || at >= limit)       \
+			goto fault;                  \
+		&cells[at];                          \
+	})
+
+	for (;;) {
+		const struct Instruction* instr = &ops[pc];
+
+		switch (instr->type) {
+		case OperationType_INC_PTR:
+			ptr += (long)instr->operand;
+			break;
+
+		case OperationType_DEC_PTR:
+			ptr -= (long)instr->operand;
+			break;
+
+		case OperationType_ADD_VAL:
+			*CELL(instr->offset) += (uint8_t)instr->operand;
+			break;
+
+		case OperationType_SUB_VAL:
+			*CELL(instr->offset) -= (uint8_t)instr->operand;
+			break;
+
+		case OperationType_SET_VAL:
+			*CELL(instr->offset) = (uint8_t)instr->operand;
+			break;
+
+		case OperationType_MUL_ADD: {
+			uint8_t value = *CELL(0);
+			*CELL(instr->offset) += value * (uint8_t)instr->operand;
+			break;
+		}
+
+		case OperationType_OUTPUT:
+			output_put(&self->out, *CELL(instr->offset));
+			break;
+
+		case OperationType_INPUT: {
+			uint8_t* cell = CELL(instr->offset);
+			int c	      = input_get(&self->in, &self->out);
+			if (c != EOF)
+				*cell = (uint8_t)c;
+			break;
+		}
+
+		case OperationType_JUMP_ZERO:
+			if (*CELL(0) == 0) {
+				pc = instr->operand + 1;
+				continue;
+			}
+			break;
+
+		case OperationType_JUMP_NONZERO:
+			if (*CELL(0) != 0) {
+				pc = instr->operand + 1;
+				continue;
+			}
+			break;
+
+		case OperationType_SCAN_RIGHT: {
+			uint8_t* cell = CELL(0);
+			long distance = (long)scan_right(
+				cell, (size_t)(limit - ptr), instr->operand);
+			(void)CELL(distance);
+			ptr += distance;
+			break;
+		}
+
+		case OperationType_SCAN_LEFT: {
+			uint8_t* cell = CELL(0);
+			long distance = (long)scan_left(
+				cell, (size_t)(ptr + left) + 1, instr->operand);
+			(void)CELL(-distance);
+			ptr -= distance;
+			break;
+		}
+
+		case OperationType_WRITE_LITERAL:
+			output_write(&self->out, prog->data + instr->offset,
+				     instr->operand);
+			break;
+
+		case OperationType_HALT:
+			return;
+		}
+		pc++;
+	}
+
+#undef CELL
+
+fault:
+	self->fault = at >= limit ? TapFault_RIGHT : TapFault_LEFT;
+}
+
+/* Runs every active lane to the end, in the group and then alone. */
+void group_run(struct Group* self, const struct Program* prog)
+{
+	self->split = 0;
+	group_exec(self, prog);
+
+	for (uint32_t m = self->split; m; m &= m - 1) {
+		struct Lane* lane = &self->lanes[__builtin_ctz(m)];
+		if (lane->fault == TapFault_NONE)
+			lane_exec(lane, prog, self->left, self->limit);
+		free(lane->tape);
+		lane->tape = nullptr;
+	}
+}
+
+/*
+ * --batch: one compiled program over many inputs, SPMD_LANES at a time.
+ * Inputs are taken in order, a group's worth at once, by as many worker
+ * threads as --threads asks for; each worker owns a Group and runs its
+ * lanes to the end before claiming the next group.
+ */
+#define BATCH_MAX_THREADS 256
+
+struct Batch {
+	const struct Program* prog;
+	size_t limit;
+
+	char** inputs;
+	size_t input_count;
+	const char* out_dir;
+
+	/* First input not yet claimed by a worker. */
+	size_t next;
+
+	size_t failed;
+	size_t split;
+	bool broken;
+};
+
+static int batch_compare(const void* a, const void* b)
+{
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static bool batch_is_output(const char* name)
+{
+	size_t len = strlen(name);
+	return len >= 4 && strcmp(name + len - 4, ".out") == 0;
+}
+
+bool batch_add(struct Batch* self, size_t* capacity, char* path)
+{
+	if (!path)
+		return false;
+	if (self->input_count == *capacity) {
+		size_t new_cap = *capacity ? *capacity * 2 : 256;
+		char** grown   = realloc(self->inputs, sizeof(char*) * new_cap);
+		if (!grown) {
+			free(path);
+			return false;
+		}
+		self->inputs = grown;
+		*capacity    = new_cap;
+	}
+	self->inputs[self->input_count++] = path;
+	return true;
+}
+
+/*
+ * `spec` is either a directory, whose regular files are the inputs (minus
+ * the *.out files a previous batch left there), or a file listing one
+ * input path per line.
+ */
+bool batch_collect(struct Batch* self, const char* spec)
+{
+	size_t capacity = 0;
+
+	DIR* dir = opendir(spec);
+	if (dir) {
+		bool ok = true;
+		struct dirent* entry;
+		while (ok && (entry = readdir(dir))) {
+			if (entry->d_name[0] == '.' ||
+			    batch_is_output(entry->d_name))
+				continue;
+
+			char path[PATH_MAX];
+			int n = snprintf(path, sizeof(path), "%s/%s", spec,
+					 entry->d_name);
+			struct stat st;
+			if (n < 0 || (size_t)n >= sizeof(path) ||
+			    stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+				continue;
+			ok = batch_add(self, &capacity, strdup(path));
+		}
+		closedir(dir);
+		if (!ok)
+			return false;
+		qsort(self->inputs, self->input_count, sizeof(char*),
+		      batch_compare);
+		return true;
+	}
+
+	struct Source list;
+	if (!source_load(&list, spec))
+		return false;
+
+	bool ok = true;
+	for (size_t i = 0; ok && i < list.size;) {
+		size_t end = i;
+		while (end < list.size && list.data[end] != '\n')
+			end++;
+		size_t len = end - i;
+		if (len > 0 && list.data[end - 1] == '\r')
+			len--;
+		if (len > 0)
+			ok = batch_add(self, &capacity,
+				       strndup(list.data + i, len));
+		i = end + 1;
+	}
+	source_free(&list);
+	return ok;
+}
+
+void batch_free(struct Batch* self)
+{
+	for (size_t k = 0; k < self->input_count; ++k)
+		free(self->inputs[k]);
+	free(self->inputs);
+	self->inputs	  = nullptr;
+	self->input_count = 0;
+}
+
+/* "<input>.out", or the input's file name under --out-dir. */
+bool batch_output_path(const struct Batch* self, const char* input,
+		       char* path, size_t size)
+{
+	int n;
+	if (self->out_dir) {
+		const char* name = strrchr(input, '/');
+		n = snprintf(path, size, "%s/%s.out", self->out_dir,
+			     name ? name + 1 : input);
+	} else {
+		n = snprintf(path, size, "%s.out", input);
+	}
+	return n > 0 && (size_t)n < size;
+}
+
+/* Errors name the input; stderr is locked so workers' lines don't mix. */
+static void batch_report(const char* input, const char* what,
+			 enum TapFault fault)
+{
+	flockfile(stderr);
+	fprintf(stderr, "%s: ", input);
+	if (what)
+		fprintf(stderr, "Error: %s: %s\n", what, strerror(errno));
+	else
+		tap_report_fault(fault);
+	funlockfile(stderr);
+}
+
+/* Sets lane up for `input`; false (reported) if it cannot run. */
+bool batch_open_lane(const struct Batch* self, struct Lane* lane,
+		     const char* input)
+{
+	lane->name  = input;
+	lane->fault = TapFault_NONE;
+	lane->out.fd = -1;
+
+	if (!source_load(&lane->source, input)) {
+		batch_report(input, "Failed to read input", TapFault_NONE);
+		return false;
+	}
+
+	char path[PATH_MAX];
+	if (batch_output_path(self, input, path, sizeof(path)))
+		lane->out.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (lane->out.fd < 0) {
+		batch_report(input, "Failed to open output", TapFault_NONE);
+		source_free(&lane->source);
+		return false;
+	}
+
+	lane->out.size = 0;
+	lane->in       = (struct Input){
+		      .data = (const uint8_t*)lane->source.data,
+		      .size = lane->source.size};
+	return true;
+}
+
+bool batch_close_lane(struct Lane* lane)
+{
+	bool ok = lane->fault == TapFault_NONE;
+	if (!ok)
+		batch_report(lane->name, nullptr, lane->fault);
+
+	ok = output_flush(&lane->out) && ok;
+	ok = close(lane->out.fd) == 0 && ok;
+	source_free(&lane->source);
+	return ok;
+}
+
+void* batch_worker(void* arg)
+{
+	struct Batch* self = arg;
+	size_t failed	   = 0;
+	size_t split	   = 0;
+
+	struct Group* group = calloc(1, sizeof(struct Group));
+	if (!group || !group_init(group, self->limit, self->prog->reach)) {
+		fprintf(stderr, "Failed to initialize tape.\n");
+		free(group);
+		__atomic_store_n(&self->broken, true, __ATOMIC_RELAXED);
+		return nullptr;
+	}
+
+	for (;;) {
+		size_t first = __atomic_fetch_add(&self->next, SPMD_LANES,
+						  __ATOMIC_RELAXED);
+		if (first >= self->input_count)
+			break;
+		size_t count = self->input_count - first;
+		if (count > SPMD_LANES)
+			count = SPMD_LANES;
+
+		group->active = 0;
+		for (size_t k = 0; k < count; ++k) {
+			if (batch_open_lane(self, &group->lanes[k],
+					    self->inputs[first + k]))
+				group->active |= 1u << k;
+			else
+				failed++;
+		}
+		uint32_t opened = group->active;
+		if (!opened)
+			continue;
+
+		group_run(group, self->prog);
+		split += (size_t)__builtin_popcount(group->split);
+
+		for (uint32_t m = opened; m; m &= m - 1) {
+			if (!batch_close_lane(&group->lanes[__builtin_ctz(m)]))
+				failed++;
+		}
+		group_reset(group);
+	}
+
+	group_deinit(group);
+	free(group);
+
+	__atomic_fetch_add(&self->split, split, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&self->failed, failed, __ATOMIC_RELAXED);
+	return nullptr;
+}
+
+/* Returns how many inputs failed, or SIZE_MAX if the batch never ran. */
+size_t batch_run(struct Batch* self, size_t threads)
+{
+	size_t groups = (self->input_count + SPMD_LANES - 1) / SPMD_LANES;
+	if (threads > groups)
+		threads = groups;
+	if (threads > BATCH_MAX_THREADS)
+		threads = BATCH_MAX_THREADS;
+	if (threads == 0)
+		return 0;
+
+	pthread_t* workers = calloc(threads, sizeof(pthread_t));
+	if (!workers)
+		return SIZE_MAX;
+
+	/* Worker 0 runs on this thread; the rest just share out the groups. */
+	size_t started = 1;
+	for (; started < threads; ++started) {
+		if (pthread_create(&workers[started], nullptr, batch_worker,
+				   self) != 0)
+			break;
+	}
+	batch_worker(self);
+	for (size_t k = 1; k < started; ++k)
+		pthread_join(workers[k], nullptr);
+
+	free(workers);
+	return self->broken ? SIZE_MAX : self->failed;
+}
+
+struct Config {
+	bool verbose;
+	bool line_buffered;
+	const char* filename;
+	size_t max_cells_limit;
+	const char* batch;
+	const char* out_dir;
+	size_t threads;
+};
+
+void print_usage(const char* prog_name)
+{
+	printf("Usage: %s [options] <file>\n", prog_name);
+	printf("  -h, --help           Show help\n");
+	printf("  -v, --verbose        Verbose output\n");
+	printf("  -l, --line-buffered  Flush program output at every "
+	       "newline\n");
+	printf("  -m, --max <cells>    Set max tape length limit (30000 cells "
+	       "default)\n");
+	printf("  -b, --batch <in>     Run every file in directory <in>, or "
+	       "listed in file\n"
+	       "                       <in>, as input; output goes to "
+	       "<input>.out\n");
+	printf("  -o, --out-dir <dir>  Write --batch outputs to <dir> "
+	       "instead\n");
+	printf("  -t, --threads <n>    --batch worker threads (one per CPU "
+	       "default)\n");
+}
+
+/*
+ * Runs the whole front end, from source to the Program the groups run.
+ * Prints what went wrong and returns false on failure.
+ */
+bool build_program(const struct Source* source, const struct Config* config,
+		   struct Program* program)
+{
+	if (config->verbose)
+		printf("Compiling...\n");
+
+	char* commands = malloc(source->size + STRIP_SLACK);
+	if (!commands) {
+		fprintf(stderr, "Failed to init program memory.\n");
+		return false;
+	}
+	size_t size = strip_comments(source->data, source->size, commands);
+
+	enum BfStatus status = compile_source(commands, size, program);
+	free(commands);
+	if (status != BfStatus_OK)
+		fprintf(stderr, "Error: %s\n", bf_status_message(status));
+
+	if (status != BfStatus_OK ||
+	    !fold_constant_prefix(program, config->max_cells_limit)) {
+		fprintf(stderr, "Compilation Failed.\n");
+		return false;
+	}
+
+	if (config->verbose)
+		printf("Compilation success. Ops count: %zu\n", program->size);
+	return true;
+}
+
+/* Without --batch the program runs once, on stdin, as a group of one. */
+bool run_single(const struct Config* config, const struct Program* program)
+{
+	struct Group* group = calloc(1, sizeof(struct Group));
+	if (!group || !group_init(group, config->max_cells_limit,
+				  program->reach)) {
+		fprintf(stderr, "Failed to initialize tape.\n");
+		free(group);
+		return false;
+	}
+
+	struct Lane* lane	  = &group->lanes[0];
+	lane->out.fd		  = STDOUT_FILENO;
+	lane->out.line_buffered = config->line_buffered;
+	group->active		  = lanes_all(1);
+
+	if (config->verbose)
+		printf("Running...\n");
+	fflush(stdout);
+
+	group_run(group, program);
+	output_flush(&lane->out);
+	tap_report_fault(lane->fault);
+
+	group_deinit(group);
+	free(group);
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	struct Config config = {.verbose	 = false,
+				.filename	 = nullptr,
+				.max_cells_limit = 30000,
+				.line_buffered	 = false};
+
+	static const struct option long_options[] = {
+		{"help", no_argument, 0, 'h'},
+		{"verbose", no_argument, 0, 'v'},
+		{"line-buffered", no_argument, 0, 'l'},
+		{"max", required_argument, 0, 'm'},
+		{"batch", required_argument, 0, 'b'},
+		{"out-dir", required_argument, 0, 'o'},
+		{"threads", required_argument, 0, 't'},
+		{0}};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "hvlm:b:o:t:", long_options,
+				  nullptr)) != -1) {
+		switch (opt) {
+		case 'h':
+			print_usage(argv[0]);
+			return 0;
+		case 'v':
+			config.verbose = true;
+			break;
+		case 'l':
+			config.line_buffered = true;
+			break;
+		case 'm': {
+			char* endptr;
+			unsigned long long limit =
+				strtoull(optarg, &endptr, 10);
+			if (*endptr != '\0' || limit == 0)
+				return EXIT_FAILURE;
+			config.max_cells_limit = (size_t)limit;
+			break;
+		}
+		case 'b':
+			config.batch = optarg;
+			break;
+		case 'o':
+			config.out_dir = optarg;
+			break;
+		case 't': {
+			char* endptr;
+			unsigned long long threads =
+				strtoull(optarg, &endptr, 10);
+			if (*endptr != '\0' || threads == 0)
+				return EXIT_FAILURE;
+			config.threads = (size_t)threads;
+			break;
+		}
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind < argc) {
+		config.filename = argv[optind];
+	} else {
+		fprintf(stderr, "Error: No input file.\n");
+		print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	struct Source source;
+	if (!source_load(&source, config.filename)) {
+		perror("Failed to read file");
+		return EXIT_FAILURE;
+	}
+
+	struct Program program;
+	if (!program_init(&program)) {
+		fprintf(stderr, "Failed to init program memory.\n");
+		source_free(&source);
+		return EXIT_FAILURE;
+	}
+
+	bool built = build_program(&source, &config, &program);
+	source_free(&source);
+	if (!built) {
+		program_free(&program);
+		return EXIT_FAILURE;
+	}
+
+	if (!config.batch) {
+		bool ran = run_single(&config, &program);
+		program_free(&program);
+		return ran ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	struct Batch batch = {.prog    = &program,
+			      .limit   = config.max_cells_limit,
+			      .out_dir = config.out_dir};
+
+	size_t failed = SIZE_MAX;
+	if (!batch_collect(&batch, config.batch)) {
+		perror("Failed to list batch inputs");
+	} else {
+		long cpus      = sysconf(_SC_NPROCESSORS_ONLN);
+		size_t threads = config.threads ? config.threads
+				 : cpus > 0	? (size_t)cpus
+						: 1;
+		failed	       = batch_run(&batch, threads);
+		if (config.verbose && failed != SIZE_MAX)
+			printf("Batch: %zu inputs in groups of %d, %zu failed, "
+			       "%zu split off to run alone\n",
+			       batch.input_count, SPMD_LANES, failed,
+			       batch.split);
+	}
+
+	batch_free(&batch);
+	program_free(&program);
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
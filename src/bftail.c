@@ -0,0 +1,452 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "frontend.h"
+#include "source.h"
+#include "tape.h"
+
+/* Names this engine's opcode set in its bytecode cache keys. */
+#define CACHE_FORMAT CACHE_FORMAT_FUSED("bftail")
+
+/*
+ * Every opcode is its own function, and every handler ends by tail-calling
+ * the next one, so the run is a chain of jumps that never returns until
+ * HALT.  The interpreter state lives in the four arguments, which stay in
+ * registers from handler to handler; nothing else is live across a
+ * dispatch, so there is nothing to spill.
+ *
+ * MUSTTAIL makes the tail call a guarantee.  Without it we rely on the
+ * compiler's sibling call optimization (on at -O2), and a build without
+ * optimization grows the stack with every op.
+ */
+#if defined(__has_attribute)
+#if __has_attribute(musttail)
+#define MUSTTAIL __attribute__((musttail))
+#endif
+#endif
+#ifndef MUSTTAIL
+#define MUSTTAIL
+#endif
+
+struct TailContext {
+	struct Tap* tap;
+	struct Output* out;
+	const uint8_t* data;
+};
+
+#define TAIL_PARAMS                                              \
+	const uint32_t *words, const uint32_t *pc, uint8_t *curr_ptr, \
+		struct TailContext *ctx
+
+#define TAIL_OPCODES(OP)                                                \
+	OP(INC_PTR)                                                     \
+	OP(DEC_PTR)                                                     \
+	OP(ADD_VAL)                                                     \
+	OP(SUB_VAL)                                                     \
+	OP(OUTPUT)                                                      \
+	OP(INPUT)                                                       \
+	OP(JUMP_ZERO)                                                   \
+	OP(JUMP_NONZERO)                                                \
+	OP(SET_VAL)                                                     \
+	OP(MUL_ADD)                                                     \
+	OP(SCAN_RIGHT)                                                  \
+	OP(SCAN_LEFT)                                                   \
+	OP(WRITE_LITERAL)                                               \
+	OP(HALT)                                                        \
+	OP(INC_PTR_WIDE)                                                \
+	OP(DEC_PTR_WIDE)                                                \
+	OP(JUMP_ZERO_WIDE)                                              \
+	OP(JUMP_NONZERO_WIDE)                                           \
+	OP(SCAN_RIGHT_WIDE)                                             \
+	OP(SCAN_LEFT_WIDE)
+
+#define TAIL_DECLARE(name) static void tail_##name(TAIL_PARAMS);
+#define TAIL_DECLARE_SUPER(first, second) \
+	static void tail_##first##_##second(TAIL_PARAMS);
+TAIL_OPCODES(TAIL_DECLARE)
+SUPERINSTRUCTIONS(TAIL_DECLARE_SUPER)
+#undef TAIL_DECLARE
+#undef TAIL_DECLARE_SUPER
+
+static void (*const tail_table[OpCode_COUNT])(TAIL_PARAMS) = {
+#define TAIL_ENTRY(name) [OpCode_##name] = tail_##name,
+#define TAIL_ENTRY_SUPER(first, second) \
+	[OpCode_##first##_##second] = tail_##first##_##second,
+	TAIL_OPCODES(TAIL_ENTRY) SUPERINSTRUCTIONS(TAIL_ENTRY_SUPER)
+#undef TAIL_ENTRY
+#undef TAIL_ENTRY_SUPER
+};
+
+#define JUMP(target)                                                   \
+	do {                                                           \
+		const uint32_t* next_ = words + (target);              \
+		MUSTTAIL return tail_table[WORD_OPCODE(*next_)](       \
+			words, next_, curr_ptr, ctx);                  \
+	} while (0)
+
+#define DISPATCH(size)                                                 \
+	do {                                                           \
+		const uint32_t* next_ = pc + (size);                   \
+		MUSTTAIL return tail_table[WORD_OPCODE(*next_)](       \
+			words, next_, curr_ptr, ctx);                  \
+	} while (0)
+
+/* The single-word ops, shared by the plain and the fused handlers. */
+#define OP_INC_PTR(w) curr_ptr += WORD_OPERAND(w)
+#define OP_DEC_PTR(w) curr_ptr -= WORD_OPERAND(w)
+#define OP_ADD_VAL(w) curr_ptr[WORD_OFFSET(w)] += WORD_VALUE(w)
+#define OP_SUB_VAL(w) curr_ptr[WORD_OFFSET(w)] -= WORD_VALUE(w)
+#define OP_OUTPUT(w) output_put(ctx->out, curr_ptr[WORD_OFFSET(w)])
+#define OP_INPUT(w)                                            \
+	do {                                                   \
+		output_flush(ctx->out);                        \
+		int c = getchar();                             \
+		if (c != EOF)                                  \
+			curr_ptr[WORD_OFFSET(w)] = (uint8_t)c; \
+	} while (0)
+#define OP_JUMP_ZERO(w)                        \
+	do {                                   \
+		if (*curr_ptr == 0)            \
+			JUMP(WORD_OPERAND(w)); \
+	} while (0)
+#define OP_JUMP_NONZERO(w)                     \
+	do {                                   \
+		if (*curr_ptr != 0)            \
+			JUMP(WORD_OPERAND(w)); \
+	} while (0)
+#define OP_SET_VAL(w) curr_ptr[WORD_OFFSET(w)] = WORD_VALUE(w)
+#define OP_MUL_ADD(w) curr_ptr[WORD_OFFSET(w)] += *curr_ptr * WORD_VALUE(w)
+#define OP_SCAN_RIGHT(w) \
+	curr_ptr = tap_scan_right(ctx->tap, curr_ptr, WORD_OPERAND(w))
+#define OP_SCAN_LEFT(w) \
+	curr_ptr = tap_scan_left(ctx->tap, curr_ptr, WORD_OPERAND(w))
+
+#define TAIL_NARROW(name)                        \
+	static void tail_##name(TAIL_PARAMS)     \
+	{                                        \
+		OP_##name(*pc);                  \
+		DISPATCH(1);                     \
+	}
+TAIL_NARROW(INC_PTR)
+TAIL_NARROW(DEC_PTR)
+TAIL_NARROW(ADD_VAL)
+TAIL_NARROW(SUB_VAL)
+TAIL_NARROW(OUTPUT)
+TAIL_NARROW(INPUT)
+TAIL_NARROW(JUMP_ZERO)
+TAIL_NARROW(JUMP_NONZERO)
+TAIL_NARROW(SET_VAL)
+TAIL_NARROW(MUL_ADD)
+TAIL_NARROW(SCAN_RIGHT)
+TAIL_NARROW(SCAN_LEFT)
+#undef TAIL_NARROW
+
+/* The first op runs from pc[0], then the second from pc[1]. */
+#define TAIL_SUPER(first, second)                          \
+	static void tail_##first##_##second(TAIL_PARAMS)   \
+	{                                                  \
+		OP_##first(pc[0]);                         \
+		pc++;                                      \
+		OP_##second(pc[0]);                        \
+		DISPATCH(1);                               \
+	}
+SUPERINSTRUCTIONS(TAIL_SUPER)
+#undef TAIL_SUPER
+
+static void tail_WRITE_LITERAL(TAIL_PARAMS)
+{
+	output_write(ctx->out, ctx->data + bytecode_wide(pc + 3),
+		     bytecode_wide(pc + 1));
+	DISPATCH(5);
+}
+
+static void tail_HALT(TAIL_PARAMS)
+{
+	(void)words;
+	(void)pc;
+	(void)curr_ptr;
+	(void)ctx;
+}
+
+static void tail_INC_PTR_WIDE(TAIL_PARAMS)
+{
+	curr_ptr += bytecode_wide(pc + 1);
+	DISPATCH(3);
+}
+
+static void tail_DEC_PTR_WIDE(TAIL_PARAMS)
+{
+	curr_ptr -= bytecode_wide(pc + 1);
+	DISPATCH(3);
+}
+
+static void tail_JUMP_ZERO_WIDE(TAIL_PARAMS)
+{
+	if (*curr_ptr == 0)
+		JUMP(bytecode_wide(pc + 1));
+	DISPATCH(3);
+}
+
+static void tail_JUMP_NONZERO_WIDE(TAIL_PARAMS)
+{
+	if (*curr_ptr != 0)
+		JUMP(bytecode_wide(pc + 1));
+	DISPATCH(3);
+}
+
+static void tail_SCAN_RIGHT_WIDE(TAIL_PARAMS)
+{
+	curr_ptr = tap_scan_right(ctx->tap, curr_ptr, bytecode_wide(pc + 1));
+	DISPATCH(3);
+}
+
+static void tail_SCAN_LEFT_WIDE(TAIL_PARAMS)
+{
+	curr_ptr = tap_scan_left(ctx->tap, curr_ptr, bytecode_wide(pc + 1));
+	DISPATCH(3);
+}
+
+/* Tape faults past the limit unwind back here through tap_fault. */
+void tap_run(struct Tap* self, const struct Bytecode* code,
+	     struct Output* out)
+{
+	struct TailContext ctx = {.tap = self, .out = out, .data = code->data};
+
+	if (sigsetjmp(self->escape, 1) != 0) {
+		tap_report_fault(self->fault);
+		return;
+	}
+	tail_table[WORD_OPCODE(code->words[0])](code->words, code->words,
+						 tap_get_ptr(self), &ctx);
+}
+
+struct Config {
+	size_t tape_size;
+	bool verbose;
+	bool line_buffered;
+	const char* filename;
+	size_t max_cells_limit;
+	const char* cache_dir;
+};
+
+void print_usage(const char* prog_name)
+{
+	printf("Usage: %s [options] <file>\n", prog_name);
+	printf("  -h, --help           Show help\n");
+	printf("  -v, --verbose        Verbose output\n");
+	printf("  -l, --line-buffered  Flush program output at every "
+	       "newline\n");
+	printf("  -s, --size <cells>   Initial tape size (1024 cells "
+	       "default)\n");
+	printf("  -m, --max <cells>    Set max tape length limit (30000 cells "
+	       "default)\n");
+	printf("  -c, --cache <dir>    Reuse compiled bytecode cached in "
+	       "<dir>\n");
+}
+
+/*
+ * Runs the whole front end, from source to runnable bytecode.  Prints what
+ * went wrong and returns false on failure.
+ */
+bool build_bytecode(const struct Source* source, const struct Config* config,
+		    struct Program* program, struct Bytecode* code)
+{
+	if (config->verbose)
+		printf("Compiling...\n");
+
+	char* commands = malloc(source->size + STRIP_SLACK);
+	if (!commands) {
+		fprintf(stderr, "Failed to init program memory.\n");
+		return false;
+	}
+	size_t count = strip_comments(source->data, source->size, commands);
+
+	enum BfStatus status = compile_source(commands, count, program);
+	free(commands);
+	if (status != BfStatus_OK)
+		fprintf(stderr, "Error: %s\n", bf_status_message(status));
+
+	if (status != BfStatus_OK ||
+	    !fold_constant_prefix(program, config->max_cells_limit)) {
+		fprintf(stderr, "Compilation Failed.\n");
+		return false;
+	}
+
+	if (config->verbose)
+		printf("Compilation success. Ops count: %zu\n", program->size);
+
+	if (!bytecode_compile(program, code)) {
+		fprintf(stderr, "Compilation Failed.\n");
+		return false;
+	}
+
+	if (config->verbose)
+		printf("Bytecode: %zu bytes, %.1f ops per 64-byte cache line "
+		       "(%.1f unpacked)\n",
+		       code->size * sizeof(uint32_t),
+		       64.0 * (double)program->size /
+			       (double)(code->size * sizeof(uint32_t)),
+		       64.0 / (double)sizeof(struct Instruction));
+
+	size_t fused = bytecode_fuse(program, code);
+	if (config->verbose)
+		printf("Superinstructions: %zu pairs fused\n", fused);
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	struct Config config = {.tape_size	 = 1024,
+				.verbose	 = false,
+				.filename	 = nullptr,
+				.max_cells_limit = 30000,
+				.line_buffered	 = false};
+
+	static const struct option long_options[] = {
+		{"help", no_argument, 0, 'h'},
+		{"verbose", no_argument, 0, 'v'},
+		{"line-buffered", no_argument, 0, 'l'},
+		{"size", required_argument, 0, 's'},
+		{"max", required_argument, 0, 'm'},
+		{"cache", required_argument, 0, 'c'},
+		{0}};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "hvls:m:c:", long_options,
+				  nullptr)) != -1) {
+		switch (opt) {
+		case 'h':
+			print_usage(argv[0]);
+			return 0;
+		case 'v':
+			config.verbose = true;
+			break;
+		case 'l':
+			config.line_buffered = true;
+			break;
+		case 's': {
+			char* endptr;
+			unsigned long long size = strtoull(optarg, &endptr, 10);
+			if (*endptr != '\0' || size == 0)
+				return EXIT_FAILURE;
+			config.tape_size = (size_t)size;
+			break;
+		}
+		case 'm': {
+			char* endptr;
+			unsigned long long limit =
+				strtoull(optarg, &endptr, 10);
+			if (*endptr != '\0' || limit == 0)
+				return EXIT_FAILURE;
+			config.max_cells_limit = (size_t)limit;
+			break;
+		}
+		case 'c':
+			config.cache_dir = optarg;
+			break;
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind < argc) {
+		config.filename = argv[optind];
+	} else {
+		fprintf(stderr, "Error: No input file.\n");
+		print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	struct Source source;
+	if (!source_load(&source, config.filename)) {
+		perror("Failed to read file");
+		return EXIT_FAILURE;
+	}
+
+	struct Program program;
+	if (!program_init(&program)) {
+		fprintf(stderr, "Failed to init program memory.\n");
+		source_free(&source);
+		return EXIT_FAILURE;
+	}
+
+	char cache_file[PATH_MAX];
+	uint64_t key = cache_key(CACHE_FORMAT, source.data, source.size,
+				 config.max_cells_limit);
+	bool use_cache = config.cache_dir &&
+			 cache_path(cache_file, sizeof(cache_file),
+				    config.cache_dir, key);
+
+	struct Bytecode code;
+	const struct CacheHeader* cached =
+		use_cache ? cache_load(cache_file, key, source.size,
+				     true, &code)
+			  : nullptr;
+
+	size_t margin;
+	if (cached) {
+		margin = cached->margin;
+		if (config.verbose)
+			printf("Loaded %llu ops from %s\n",
+			       (unsigned long long)cached->ops, cache_file);
+	} else {
+		if (!build_bytecode(&source, &config, &program, &code)) {
+			source_free(&source);
+			program_free(&program);
+			return EXIT_FAILURE;
+		}
+		margin = program.reach + program.travel;
+
+		if (use_cache) {
+			/* The cache directory itself is created on demand. */
+			mkdir(config.cache_dir, 0777);
+			bool stored = cache_store(cache_file, key, source.size,
+						  &program, &code);
+			if (config.verbose)
+				printf("%s %s\n",
+				       stored ? "Cached bytecode in"
+					      : "Failed to cache bytecode in",
+				       cache_file);
+		}
+	}
+
+	static struct Output output = {.fd = STDOUT_FILENO};
+	output.line_buffered	     = config.line_buffered;
+
+	struct Tap tap;
+	if (!tap_init(&tap, config.tape_size, config.max_cells_limit,
+		      margin)) {
+		fprintf(stderr, "Failed to initialize tap.\n");
+		source_free(&source);
+		bytecode_free(&code);
+		program_free(&program);
+		return EXIT_FAILURE;
+	}
+
+	if (config.verbose)
+		printf("Running...\n");
+	fflush(stdout);
+
+	tap_run(&tap, &code, &output);
+	output_flush(&output);
+
+	source_free(&source);
+	tap_deinit(&tap);
+	bytecode_free(&code);
+	program_free(&program);
+	return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,7 @@
+Scan limit regression
+Run with a max tape of 5 cells
+The scan finds no zero before the right end of the tape so the engines
+have to stop with a tape error rather than land past the end and let the
+moves after it walk the head back in
+
++++[>>>>>]<<<+++.